@@ -307,6 +307,8 @@ struct e1000_adapter {
 
 	unsigned int restart_queue;
 	u32 txd_cmd;
+	/* frames queued since the last tail write */
+	unsigned int tx_deferred;
 
 	bool detect_tx_hung;
 	bool tx_hang_recheck;
@@ -2271,6 +2271,7 @@ static void e1000_clean_tx_ring(struct e1000_adapter *adapter)
 
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
+	adapter->tx_deferred = 0;
 
 	writel(0, adapter->hw.hw_addr + tx_ring->head);
 	writel(0, adapter->hw.hw_addr + tx_ring->tail);
@@ -4702,6 +4703,8 @@ static bool e1000_tx_csum(struct e1000_adapter *adapter, struct sk_buff *skb)
 }
 
 #define E1000_MAX_PER_TXD	8192
+/* write the tail at least every this many deferred frames */
+#define E1000_XMIT_BATCH	16
 #define E1000_MAX_TXD_PWR	12
 
 static int e1000_tx_map(struct e1000_adapter *adapter,
@@ -4846,6 +4849,16 @@ static void e1000_tx_queue(struct e1000_adapter *adapter,
 
 	tx_desc->lower.data |= cpu_to_le32(adapter->txd_cmd);
 
+	tx_ring->next_to_use = i;
+}
+
+/* Moves the tail over what e1000_tx_queue queued; tx lock held. */
+static void e1000_tx_flush(struct e1000_adapter *adapter)
+{
+	struct e1000_ring *tx_ring = adapter->tx_ring;
+
+	adapter->tx_deferred = 0;
+
 	/*
 	 * Force memory writes to complete before letting h/w
 	 * know there are new descriptors to fetch.  (Only
@@ -4854,12 +4867,10 @@ static void e1000_tx_queue(struct e1000_adapter *adapter,
 	 */
 	wmb();
 
-	tx_ring->next_to_use = i;
-
 	if (adapter->flags2 & FLAG2_PCIM2PCI_ARBITER_WA)
-		e1000e_update_tdt_wa(adapter, i);
+		e1000e_update_tdt_wa(adapter, tx_ring->next_to_use);
 	else
-		writel(i, adapter->hw.hw_addr + tx_ring->tail);
+		writel(tx_ring->next_to_use, adapter->hw.hw_addr + tx_ring->tail);
 
 	/*
 	 * we need this if more than one processor can write to our tail
@@ -5024,8 +5035,12 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 	 * need: count + 2 desc gap to keep tail from touching
 	 * head, otherwise try next time
 	 */
-	if (e1000_maybe_stop_tx(netdev, count + 2))
+	if (e1000_maybe_stop_tx(netdev, count + 2)) {
+		/* the ring only drains once the hardware sees it */
+		if (adapter->tx_deferred)
+			e1000_tx_flush(adapter);
 		return NETDEV_TX_BUSY;
+	}
 
 	if (vlan_tx_tag_present(skb)) {
 		tx_flags |= E1000_TX_FLAGS_VLAN;
@@ -5061,6 +5076,10 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 		/* Make sure there is space in the ring for the next send. */
 		e1000_maybe_stop_tx(netdev, MAX_SKB_FRAGS + 2);
 
+		if (!netdev_xmit_defer(netdev) ||
+		    netif_queue_stopped(netdev) ||
+		    ++adapter->tx_deferred >= E1000_XMIT_BATCH)
+			e1000_tx_flush(adapter);
 	} else {
 		dev_kfree_skb_any(skb);
 		tx_ring->buffer_info[first].time_stamp = 0;
@@ -5070,6 +5089,19 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 	return NETDEV_TX_OK;
 }
 
+/* called at the end of an xmit batch that deferred tail writes */
+static int e1000_xmit_commit(struct net_device *netdev)
+{
+	struct e1000_adapter *adapter = netdev_priv(netdev);
+	struct netdev_queue *txq = netdev_get_tx_queue(netdev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	if (adapter->tx_deferred)
+		e1000_tx_flush(adapter);
+	__netif_tx_unlock(txq);
+	return 0;
+}
+
 /**
  * e1000_tx_timeout - Respond to a Tx Hang
  * @netdev: network interface device structure
@@ -5955,6 +5987,7 @@ static const struct net_device_ops e1000e_netdev_ops = {
 	.ndo_open		= e1000_open,
 	.ndo_stop		= e1000_close,
 	.ndo_start_xmit		= e1000_xmit_frame,
+	.ndo_xmit_commit	= e1000_xmit_commit,
 	.ndo_get_stats64	= e1000e_get_stats64,
 	.ndo_set_rx_mode	= e1000e_set_rx_mode,
 	.ndo_set_mac_address	= e1000_set_mac,
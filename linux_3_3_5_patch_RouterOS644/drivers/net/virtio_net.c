@@ -41,6 +41,9 @@ module_param(gso, bool, 0444);
 #define GOOD_COPY_LEN	128
 
 #define VIRTNET_SEND_COMMAND_SG_MAX    2
+
+/* kick at least every this many deferred buffers */
+#define VIRTNET_XMIT_BATCH	16
 #define VIRTNET_DRIVER_VERSION "1.0.0"
 
 struct virtnet_stats {
@@ -61,6 +64,9 @@ struct send_queue {
 	/* TX: fragments + linear part + virtio header */
 	struct scatterlist sg[MAX_SKB_FRAGS + 2];
 
+	/* buffers added since the last kick */
+	unsigned int xmit_deferred;
+
 	/* Name of the send queue: output.$index */
 	char name[40];
 };
@@ -752,9 +758,21 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		}
 		dev->stats.tx_dropped++;
 		kfree_skb(skb);
+		/* the host has to see what is queued to make room */
+		if (sq->xmit_deferred) {
+			sq->xmit_deferred = 0;
+			virtqueue_kick(sq->vq);
+		}
 		return NETDEV_TX_OK;
 	}
-	virtqueue_kick(sq->vq);
+
+	/* Leave the kick to virtnet_xmit_commit while the xmit batch has
+	 * more for us, but never stop the queue on an unkicked ring. */
+	if (capacity < 2+MAX_SKB_FRAGS || !netdev_xmit_defer(dev) ||
+	    ++sq->xmit_deferred >= VIRTNET_XMIT_BATCH) {
+		sq->xmit_deferred = 0;
+		virtqueue_kick(sq->vq);
+	}
 
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
@@ -777,6 +795,28 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 	return NETDEV_TX_OK;
 }
 
+/* called at the end of an xmit batch that deferred kicks */
+static int virtnet_xmit_commit(struct net_device *dev)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
+
+	for (i = 0; i < dev->real_num_tx_queues; i++) {
+		struct send_queue *sq = &vi->sq[i];
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		if (!sq->xmit_deferred)
+			continue;
+		__netif_tx_lock(txq, smp_processor_id());
+		if (sq->xmit_deferred) {
+			sq->xmit_deferred = 0;
+			virtqueue_kick(sq->vq);
+		}
+		__netif_tx_unlock(txq);
+	}
+	return 0;
+}
+
 static int virtnet_set_mac_address(struct net_device *dev, void *p)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -1243,6 +1283,7 @@ static const struct net_device_ops virtnet_netdev = {
 	.ndo_open            = virtnet_open,
 	.ndo_stop   	     = virtnet_close,
 	.ndo_start_xmit      = start_xmit,
+	.ndo_xmit_commit     = virtnet_xmit_commit,
 	.ndo_validate_addr   = eth_validate_addr,
 	.ndo_set_mac_address = virtnet_set_mac_address,
 	.ndo_set_rx_mode     = virtnet_set_rx_mode,
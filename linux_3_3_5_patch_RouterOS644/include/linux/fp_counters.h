@@ -0,0 +1,103 @@
+#ifndef _LINUX_FP_COUNTERS_H
+#define _LINUX_FP_COUNTERS_H
+
+#include <linux/types.h>
+
+/*
+ * Fast path counters page, mapped read-only from /sys/kernel/fp_counters.
+ *
+ * The mapping starts with struct fp_counters_info, followed by one region
+ * per cpu id at cpu_offset + cpu * cpu_stride. Each region is an array of
+ * nr_slots struct fp_counter, slot 0 is never used. A counter is the sum
+ * of its slot over all regions. Only the owning cpu writes its region, a
+ * reader retries a slot while seq is odd or changed under it.
+ */
+
+#define FP_COUNTERS_MAGIC	0x46504354	/* "FPCT" */
+#define FP_COUNTERS_VERSION	1
+
+struct fp_counters_info {
+	__u32 magic;
+	__u32 version;
+	__u32 nr_cpus;
+	__u32 nr_slots;
+	__u32 slot_size;
+	__u32 cpu_offset;
+	__u32 cpu_stride;
+};
+
+struct fp_counter {
+	__u32 seq;
+	__u32 gen;		/* bumped each time the slot is reused */
+	__u64 packets;
+	__u64 bytes;
+	__u64 reserved;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/compiler.h>
+#include <linux/smp.h>
+
+struct net_device;
+
+struct fp_counters_state {
+	void *base;
+	unsigned long cpu_offset;
+	unsigned long cpu_stride;
+	u32 nr_slots;
+};
+
+extern struct fp_counters_state fp_counters;
+
+extern u32 fp_counter_alloc(void);
+extern void fp_counter_free(u32 slot);
+extern void fp_counter_read(u32 slot, u64 *packets, u64 *bytes);
+extern void fp_dev_read_counters(const struct net_device *dev,
+				 u64 *rx_packets, u64 *rx_bytes,
+				 u64 *tx_packets, u64 *tx_bytes);
+
+static inline struct fp_counter *fp_counter_ptr(int cpu, u32 slot)
+{
+	return (struct fp_counter *)(fp_counters.base + fp_counters.cpu_offset +
+				     cpu * fp_counters.cpu_stride) + slot;
+}
+
+/* must not be preempted by another writer on this cpu, i.e. softirq or
+ * with BH disabled
+ */
+static inline void fp_counter_add(u32 slot, unsigned len)
+{
+	struct fp_counter *c;
+
+	if (!slot)
+		return;
+
+	c = fp_counter_ptr(smp_processor_id(), slot);
+	c->seq++;
+	smp_wmb();
+	c->packets++;
+	c->bytes += len;
+	smp_wmb();
+	c->seq++;
+}
+
+static inline void fp_counter_sub(u32 slot, unsigned len)
+{
+	struct fp_counter *c;
+
+	if (!slot)
+		return;
+
+	c = fp_counter_ptr(smp_processor_id(), slot);
+	c->seq++;
+	smp_wmb();
+	c->packets--;
+	c->bytes -= len;
+	smp_wmb();
+	c->seq++;
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_FP_COUNTERS_H */
@@ -82,6 +82,7 @@
 #define IFF_UNICAST_FLT	0x20000		/* Supports unicast filtering	*/
 #define IFF_TEAM_PORT	0x40000		/* device used as team port */
 #define IFF_SWITCH_PORT	0x80000		/* device is a switch port */
+#define IFF_ENQ_RINGS	0x100000	/* qdiscs get per cpu enqueue rings */
 
 #define IF_GET_IFACE	0x0001		/* for querying only */
 #define IF_GET_PROTO	0x0002
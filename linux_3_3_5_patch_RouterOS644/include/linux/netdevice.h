@@ -756,6 +756,12 @@ struct netdev_fcoe_hbainfo {
  *        (can also return NETDEV_TX_LOCKED iff NETIF_F_LLTX)
  *	Required can not be NULL.
  *
+ * int (*ndo_xmit_commit)(struct net_device *dev);
+ *	Hands frames the driver queued without notifying the hardware to
+ *	the device.  ndo_start_xmit may only hold frames back while
+ *	netdev_xmit_defer() says so; this is then called at the end of
+ *	the NAPI poll or dev_queue_xmit(), with no qdisc lock held.
+ *
  * u16 (*ndo_select_queue)(struct net_device *dev, struct sk_buff *skb);
  *	Called to decide which queue to when device supports multiple
  *	transmit queues.
@@ -1054,6 +1060,8 @@ struct fp_dev {
 	u64 fp_tx_byte;
 	u64 queue_stopped_drop;
 	u64 tx_drop;
+	u32 rx_counter;		/* slots in the fp_counters page */
+	u32 tx_counter;
 };
 
 struct net_device {
@@ -1816,6 +1824,57 @@ static inline void input_queue_tail_incr_save(struct softnet_data *sd,
 
 DECLARE_PER_CPU_ALIGNED(struct softnet_data, softnet_data);
 
+#define NETDEV_XMIT_BATCH_DEVS	4
+
+/* Devices holding back their doorbell on this cpu, between
+ * netdev_xmit_begin() and netdev_xmit_end() */
+struct netdev_xmit_batch {
+	unsigned int		depth;
+	unsigned int		count;
+	struct net_device	*dev[NETDEV_XMIT_BATCH_DEVS];
+};
+
+DECLARE_PER_CPU(struct netdev_xmit_batch, netdev_xmit_batch);
+
+/*
+ * Called by ndo_start_xmit of a driver with ndo_xmit_commit: true if it
+ * may leave the doorbell for ndo_xmit_commit, which is then guaranteed
+ * to be called on this cpu.  Callers outside a batch, like netpoll and
+ * pktgen, always get false.
+ */
+static inline bool netdev_xmit_defer(struct net_device *dev)
+{
+	struct netdev_xmit_batch *b = &__get_cpu_var(netdev_xmit_batch);
+	unsigned int i;
+
+	if (!b->depth || irqs_disabled())
+		return false;
+	for (i = 0; i < b->count; i++)
+		if (b->dev[i] == dev)
+			return true;
+	if (b->count == NETDEV_XMIT_BATCH_DEVS)
+		return false;
+	b->dev[b->count++] = dev;
+	return true;
+}
+
+extern void __netdev_xmit_flush(struct netdev_xmit_batch *b);
+
+/* BH must stay disabled from begin to end; batches nest and only the
+ * outermost end rings the doorbells, so no lock may be held there */
+static inline void netdev_xmit_begin(void)
+{
+	__get_cpu_var(netdev_xmit_batch).depth++;
+}
+
+static inline void netdev_xmit_end(void)
+{
+	struct netdev_xmit_batch *b = &__get_cpu_var(netdev_xmit_batch);
+
+	if (!--b->depth && b->count)
+		__netdev_xmit_flush(b);
+}
+
 extern void __netif_schedule(struct Qdisc *q);
 
 static inline void netif_schedule_queue(struct netdev_queue *txq)
@@ -84,6 +84,11 @@ enum ip_conntrack_status {
 	IPS_UNTRACKED_BIT = 12,
 	IPS_UNTRACKED = (1 << IPS_UNTRACKED_BIT),
 
+	/* Conntrack was taken out of the hash by nf_ct_delete(), can not
+	 * be unset.  Kernel internal. */
+	IPS_KILLED_BIT = 29,
+	IPS_KILLED = (1 << IPS_KILLED_BIT),
+
 	IPS_FASTPATH_BIT = 30,
 	IPS_FASTPATH = (1 << IPS_FASTPATH_BIT),
 };
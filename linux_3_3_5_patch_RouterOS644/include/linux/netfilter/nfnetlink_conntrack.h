@@ -127,6 +127,7 @@ enum ctattr_counters {
 	CTA_COUNTERS_RATE,
 	CTA_COUNTERS32_PACKETS,		/* old 32bit counters, unused */
 	CTA_COUNTERS32_BYTES,		/* old 32bit counters, unused */
+	CTA_COUNTERS_FP_COUNTER,	/* slot in /sys/kernel/fp_counters */
 	__CTA_COUNTERS_MAX
 };
 #define CTA_COUNTERS_MAX (__CTA_COUNTERS_MAX - 1)
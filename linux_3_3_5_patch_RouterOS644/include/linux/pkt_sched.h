@@ -188,6 +188,11 @@ struct tc_sfq_qopt_v1 {
 	struct tc_sfqred_stats stats;
 };
 
+struct tc_sfq_qopt_v2 {
+	struct tc_sfq_qopt_v1 v1;
+	__u32		limit_bytes;	/* max total backlog (bytes), 0 for none */
+};
+
 
 struct tc_sfq_xstats {
 	__s32		allot;
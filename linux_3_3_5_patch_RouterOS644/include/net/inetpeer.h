@@ -95,9 +95,32 @@ static inline struct inet_peer *inet_getpeer_v6(const struct in6_addr *v6daddr,
 	return inet_getpeer(&daddr, create);
 }
 
+#define XRLIM_BURST_FACTOR 6
+
 /* can be called from BH context or outside */
 extern void inet_putpeer(struct inet_peer *p);
 extern bool inet_peer_xrlim_allow(struct inet_peer *peer, int timeout);
+extern bool inet_xrlim_allow(const struct inetpeer_addr *daddr,
+			     int cost, int burst);
+
+static inline bool inet_xrlim_allow_v4(__be32 v4daddr, int timeout)
+{
+	struct inetpeer_addr daddr;
+
+	daddr.addr.a4 = v4daddr;
+	daddr.family = AF_INET;
+	return inet_xrlim_allow(&daddr, timeout, XRLIM_BURST_FACTOR * timeout);
+}
+
+static inline bool inet_xrlim_allow_v6(const struct in6_addr *v6daddr,
+				       int timeout)
+{
+	struct inetpeer_addr daddr;
+
+	*(struct in6_addr *)daddr.addr.a6 = *v6daddr;
+	daddr.family = AF_INET6;
+	return inet_xrlim_allow(&daddr, timeout, XRLIM_BURST_FACTOR * timeout);
+}
 
 extern void inetpeer_invalidate_tree(int family);
 
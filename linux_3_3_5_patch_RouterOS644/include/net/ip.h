@@ -276,7 +276,11 @@ static inline void ip_select_ident(struct iphdr *iph, struct dst_entry *dst, str
 		 */
 		iph->id = (sk && inet_sk(sk)->inet_daddr) ?
 					htons(inet_sk(sk)->inet_id++) : 0;
-	} else
+	} else if (sk && inet_sk(sk)->nopeer)
+		/* a shared counter would leak the send rate of the
+		 * socket to anyone probing it, a random ID doesn't */
+		iph->id = (__force __be16)net_random();
+	else
 		__ip_select_ident(iph, dst, 0);
 }
 
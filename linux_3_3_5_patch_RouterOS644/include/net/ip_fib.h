@@ -45,6 +45,10 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
+
+/* Forwarded input routes cached per nexthop, keyed by input ifindex */
+#define FIB_NH_RTH_SLOTS	8
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -64,6 +68,7 @@ struct fib_nh {
 	__be32			nh_gw;
 	__be32			nh_saddr;
 	int			nh_saddr_genid;
+	struct rtable __rcu	*nh_rth_input[FIB_NH_RTH_SLOTS];
 };
 
 /*
@@ -173,6 +178,7 @@ extern int fib_table_delete(struct fib_table *, struct fib_config *);
 extern int fib_table_dump(struct fib_table *table, struct sk_buff *skb,
 			  struct netlink_callback *cb);
 extern int fib_table_flush(struct fib_table *table);
+extern void fib_table_commit(struct fib_table *table);
 extern void fib_free_table(struct fib_table *tb);
 
 
@@ -234,6 +240,7 @@ extern int fib_validate_source(struct sk_buff *skb, __be32 src, __be32 dst,
 			       u8 tos, int oif, struct net_device *dev,
 			       __be32 *spec_dst, u32 *itag);
 extern void fib_select_default(struct fib_result *res);
+extern void fib_batch_commit(struct net *net);
 
 /* Exported by fib_semantics.c */
 extern int ip_fib_check_default(__be32 gw, struct net_device *dev);
@@ -539,6 +539,7 @@ extern struct dst_entry *	ip6_blackhole_route(struct net *net,
 
 extern int			ip6_output(struct sk_buff *skb);
 extern int			ip6_forward(struct sk_buff *skb);
+extern bool			ip6_fast_forward(struct sk_buff *skb);
 extern int			ip6_input(struct sk_buff *skb);
 extern int			ip6_mc_input(struct sk_buff *skb);
 
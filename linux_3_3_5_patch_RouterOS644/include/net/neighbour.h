@@ -145,7 +145,6 @@ struct neigh_hash_table {
 	struct neighbour __rcu	**hash_buckets;
 	unsigned int		hash_shift;
 	__u32			hash_rnd[NEIGH_NUM_HASH_RND];
-	struct rcu_head		rcu;
 };
 
 
@@ -170,6 +169,9 @@ struct neigh_table {
 	int			gc_thresh3;
 	unsigned long		last_flush;
 	struct delayed_work	gc_work;
+	struct work_struct	hash_work;
+	unsigned int		gc_bucket;
+	unsigned int		forced_gc_bucket;
 	struct timer_list 	proxy_timer;
 	struct sk_buff_head	proxy_queue;
 	atomic_t		entries;
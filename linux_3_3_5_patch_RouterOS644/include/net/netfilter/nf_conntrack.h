@@ -106,6 +106,8 @@ struct nf_conn {
 	struct nf_conntrack ct_general;
 
 	spinlock_t lock;
+	/* cpu whose unconfirmed or dying list we are on */
+	u16 cpu;
 
 	/* XXX should I move this to the tail ? - Y.K */
 	/* These are my tuples; original and reply */
@@ -117,8 +119,8 @@ struct nf_conn {
 	/* If we were expected by an expectation, this will be it */
 	struct nf_conn *master;
 
-	/* Timer function; drops refcnt when it goes off. */
-	struct timer_list timeout;
+	/* jiffies of the next expiry check, see nf_ct_is_expired() */
+	unsigned long timeout;
 
 #if defined(CONFIG_NF_CONNTRACK_MARK)
 	u_int32_t mark;
@@ -220,6 +222,7 @@ __nf_conntrack_find(struct net *net, u16 zone,
 extern int nf_conntrack_hash_check_insert(struct nf_conn *ct);
 extern void nf_ct_delete_from_lists(struct nf_conn *ct);
 extern void nf_ct_dying_timeout(struct nf_conn *ct);
+extern bool nf_ct_delete(struct nf_conn *ct, u32 pid, int report);
 
 extern void nf_conntrack_flush_report(struct net *net, u32 pid, int report);
 extern void nf_conntrack_change_ip(unsigned old_ip, unsigned new_ip);
@@ -316,6 +319,25 @@ static inline int nf_ct_is_untracked(const struct nf_conn *ct)
 	return test_bit(IPS_UNTRACKED_BIT, &ct->status);
 }
 
+/*
+ * A confirmed conntrack carries no timer.  ->timeout is the point at
+ * which it is next looked at (at most 60s ahead) and ->extra_timeout
+ * what is left after that; it is dead once both have run out.  Lookups
+ * check this lazily and the gc worker reaps what is not looked up.
+ */
+static inline bool nf_ct_is_expired(const struct nf_conn *ct)
+{
+	return (long)(jiffies - ct->timeout) >= (long)ct->extra_timeout;
+}
+
+/* jiffies left until a confirmed conntrack expires */
+static inline long nf_ct_expires(const struct nf_conn *ct)
+{
+	long timeout = (long)(ct->timeout - jiffies) + ct->extra_timeout;
+
+	return timeout > 0 ? timeout : 0;
+}
+
 /* Packet is received from loopback */
 static inline bool nf_is_loopback_packet(const struct sk_buff *skb)
 {
@@ -13,12 +13,14 @@
 #include <linux/netfilter/nf_conntrack_tuple_common.h>
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_extend.h>
+#include <linux/fp_counters.h>
 
 struct nf_conn_counter {
 	atomic64_t packets;
 	atomic64_t bytes;
 	atomic64_t fp_packets;
 	atomic64_t fp_bytes;
+	u32 fp_counter;		/* fp_counters slot, 0 until fasttracked */
 
 	atomic_t bytes_prev_second;
 	atomic_t bytes_this_second;
@@ -48,6 +50,15 @@ struct nf_conn_counter *nf_ct_acct_ext_add(struct nf_conn *ct, gfp_t gfp)
 	return acct;
 };
 
+/* fast path packets/bytes are fp_packets/fp_bytes plus the fp_counters slot */
+static inline void nf_ct_acct_fp_read(const struct nf_conn_counter *acct,
+				      u64 *packets, u64 *bytes)
+{
+	fp_counter_read(acct->fp_counter, packets, bytes);
+	*packets += atomic64_read(&acct->fp_packets);
+	*bytes += atomic64_read(&acct->fp_bytes);
+}
+
 extern unsigned int
 seq_print_acct(struct seq_file *s, const struct nf_conn *ct, int dir);
 
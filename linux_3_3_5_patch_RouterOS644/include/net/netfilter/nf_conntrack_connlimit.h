@@ -0,0 +1,33 @@
+#ifndef _NF_CONNTRACK_CONNLIMIT_H
+#define _NF_CONNTRACK_CONNLIMIT_H
+
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_extend.h>
+
+struct connlimit_conn;
+
+/* Lists the connlimit rules that counted the conntrack, so destroying it
+ * visits only those. Reserved by init_conntrack() while the connlimit
+ * match is loaded, so a rule set up after the conntrack was confirmed can
+ * still count it.
+ */
+struct nf_conn_connlimit {
+	struct connlimit_conn *conns;
+};
+
+/* called from the extension destructor */
+extern void (*connlimit_destroy_conntrack)(struct nf_conn *);
+
+static inline
+struct nf_conn_connlimit *nf_ct_connlimit_find(const struct nf_conn *ct)
+{
+	return nf_ct_ext_find(ct, NF_CT_EXT_CONNLIMIT);
+}
+
+static inline
+struct nf_conn_connlimit *nf_ct_connlimit_ext_add(struct nf_conn *ct, gfp_t gfp)
+{
+	return nf_ct_ext_add(ct, NF_CT_EXT_CONNLIMIT, gfp);
+}
+
+#endif /* _NF_CONNTRACK_CONNLIMIT_H */
@@ -74,6 +74,13 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
+/* protects expectations and helper assignment */
 extern spinlock_t nf_conntrack_lock ;
 
+/* protect the conntrack hash, see nf_conntrack_core.c */
+#define CONNTRACK_LOCKS 1024
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_lock_bucket(unsigned int bucket);
+extern void nf_conntrack_unlock_bucket(unsigned int bucket);
+
 #endif /* _NF_CONNTRACK_CORE_H */
@@ -20,6 +20,8 @@ enum nf_ct_ext_id {
 #ifdef CONFIG_NF_CONNTRACK_TIMESTAMP
 	NF_CT_EXT_TSTAMP,
 #endif
+	NF_CT_EXT_CONNLIMIT,
+	NF_CT_EXT_PCC,
 	NF_CT_EXT_NUM,
 };
 
@@ -29,6 +31,8 @@ enum nf_ct_ext_id {
 #define NF_CT_EXT_ECACHE_TYPE struct nf_conntrack_ecache
 #define NF_CT_EXT_ZONE_TYPE struct nf_conntrack_zone
 #define NF_CT_EXT_TSTAMP_TYPE struct nf_conn_tstamp
+#define NF_CT_EXT_CONNLIMIT_TYPE struct nf_conn_connlimit
+#define NF_CT_EXT_PCC_TYPE struct nf_conn_pcc
 
 /* Extensions: optional stuff which isn't permanently in struct. */
 struct nf_ct_ext {
@@ -0,0 +1,32 @@
+#ifndef _NF_CONNTRACK_PCC_H
+#define _NF_CONNTRACK_PCC_H
+
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_extend.h>
+
+#define NF_CT_PCC_SLOTS		4
+
+/* Per connection classifier hashes, one per set of hashed fields,
+ * direction and hook (NAT rewrites the tuple between hooks). Only filled
+ * while the conntrack is unconfirmed, so readers of a confirmed conntrack
+ * see them stable.
+ */
+struct nf_conn_pcc {
+	struct {
+		u16 key;	/* 0 when the slot is unused */
+		u32 hash;
+	} slot[NF_CT_PCC_SLOTS];
+};
+
+static inline struct nf_conn_pcc *nf_ct_pcc_find(const struct nf_conn *ct)
+{
+	return nf_ct_ext_find(ct, NF_CT_EXT_PCC);
+}
+
+static inline struct nf_conn_pcc *nf_ct_pcc_ext_add(struct nf_conn *ct,
+						    gfp_t gfp)
+{
+	return nf_ct_ext_add(ct, NF_CT_EXT_PCC, gfp);
+}
+
+#endif /* _NF_CONNTRACK_PCC_H */
@@ -27,6 +27,8 @@ struct netns_ipv4 {
 #endif
 	struct hlist_head	*fib_table_hash;
 	struct sock		*fibnl;
+	bool			fib_batch;
+	bool			fib_batch_changed;
 
 	struct sock		**icmp_sk;
 	struct sock		*tcp_sock;
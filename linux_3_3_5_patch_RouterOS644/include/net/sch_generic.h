@@ -89,8 +89,33 @@ struct Qdisc {
 	u32			limit;
 
 	void *lockless_classify_arg;
+	struct qdisc_enq_ring __percpu *enq_rings;
+	cpumask_var_t		enq_pending;
 };
 
+/* Per cpu rings for enqueueing into a qdisc without its lock. Each ring
+ * has one producer, its cpu with BH disabled, and one consumer, whoever
+ * runs the qdisc, which moves the packets into the qdisc under the root
+ * lock before dequeueing. enq_pending marks the cpus whose ring may hold
+ * packets. Allocated for qdiscs with enqueue_classified on devices with
+ * IFF_ENQ_RINGS.
+ */
+#define QDISC_ENQ_RING_SIZE	128
+
+struct qdisc_enq_ring {
+	unsigned int		head;
+	unsigned int		tail ____cacheline_aligned_in_smp;
+	struct {
+		struct sk_buff	*skb;
+		u32		classid;
+	} entry[QDISC_ENQ_RING_SIZE];
+};
+
+extern bool qdisc_enqueue_ring(struct Qdisc *q, struct sk_buff *skb,
+			       u32 classid);
+extern void qdisc_drain_rings(struct Qdisc *q);
+extern void qdisc_free_rings(struct Qdisc *q);
+
 static inline bool qdisc_is_running(const struct Qdisc *qdisc)
 {
 	return (qdisc->__state & __QDISC___STATE_RUNNING) ? true : false;
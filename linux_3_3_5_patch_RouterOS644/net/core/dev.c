@@ -136,6 +136,7 @@
 #include <linux/net_tstamp.h>
 #include <linux/jump_label.h>
 #include <net/flow_keys.h>
+#include <linux/fp_counters.h>
 
 #include "net-sysfs.h"
 
@@ -282,6 +283,20 @@ static RAW_NOTIFIER_HEAD(netdev_chain);
 DEFINE_PER_CPU_ALIGNED(struct softnet_data, softnet_data);
 EXPORT_PER_CPU_SYMBOL(softnet_data);
 
+DEFINE_PER_CPU(struct netdev_xmit_batch, netdev_xmit_batch);
+EXPORT_PER_CPU_SYMBOL(netdev_xmit_batch);
+
+/* Ring the doorbells held back since the outermost netdev_xmit_begin() */
+void __netdev_xmit_flush(struct netdev_xmit_batch *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->count; i++)
+		b->dev[i]->netdev_ops->ndo_xmit_commit(b->dev[i]);
+	b->count = 0;
+}
+EXPORT_SYMBOL(__netdev_xmit_flush);
+
 #ifdef CONFIG_LOCKDEP
 /*
  * register_netdevice() inits txq->_xmit_lock and sets lockdep class
@@ -2590,6 +2605,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 	 * stops preemption for RCU.
 	 */
 	rcu_read_lock_bh();
+	netdev_xmit_begin();
 
 	skb_update_prio(skb);
 
@@ -2672,11 +2688,13 @@ recursion_alert:
 	}
 
 	rc = -ENETDOWN;
+	netdev_xmit_end();
 	rcu_read_unlock_bh();
 
 	kfree_skb(skb);
 	return rc;
 out:
+	netdev_xmit_end();
 	rcu_read_unlock_bh();
 	return rc;
 }
@@ -3096,6 +3114,7 @@ static void net_tx_action(struct softirq_action *h)
 		sd->output_queue_tailp = &sd->output_queue;
 		local_irq_enable();
 
+		netdev_xmit_begin();
 		while (head) {
 			struct Qdisc *q = head;
 			spinlock_t *root_lock;
@@ -3120,6 +3139,7 @@ static void net_tx_action(struct softirq_action *h)
 				}
 			}
 		}
+		netdev_xmit_end();
 	}
 }
 
@@ -3966,11 +3986,14 @@ static void net_rx_action(struct softirq_action *h)
 		 * actually make the ->poll() call.  Therefore we avoid
 		 * accidentally calling ->poll() when NAPI is not scheduled.
 		 */
+		/* what the poll forwards gets one doorbell per device */
 		work = 0;
+		netdev_xmit_begin();
 		if (test_bit(NAPI_STATE_SCHED, &n->state)) {
 			work = n->poll(n, weight);
 			trace_napi_poll(n);
 		}
+		netdev_xmit_end();
 
 		WARN_ON_ONCE(work > weight);
 
@@ -5826,6 +5849,12 @@ int register_netdevice(struct net_device *dev)
 		}
 	}
 
+	/* a device without slots falls back to the folded fp stats */
+	if (!dev->fp.rx_counter)
+		dev->fp.rx_counter = fp_counter_alloc();
+	if (!dev->fp.tx_counter)
+		dev->fp.tx_counter = fp_counter_alloc();
+
 	dev->ifindex = dev_new_index(net);
 	if (dev->iflink == -1)
 		dev->iflink = dev->ifindex;
@@ -6328,6 +6357,11 @@ void free_netdev(struct net_device *dev)
 	list_for_each_entry_safe(p, n, &dev->napi_list, dev_list)
 		netif_napi_del(p);
 
+	fp_counter_free(dev->fp.rx_counter);
+	fp_counter_free(dev->fp.tx_counter);
+	dev->fp.rx_counter = 0;
+	dev->fp.tx_counter = 0;
+
 	free_percpu(dev->pcpu_refcnt);
 	dev->pcpu_refcnt = NULL;
 
@@ -0,0 +1,206 @@
+/*
+ *	Per-cpu fast path counters in a page userspace can map
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/bitmap.h>
+#include <linux/spinlock.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/netdevice.h>
+#include <linux/fp_counters.h>
+
+struct fp_counters_state fp_counters __read_mostly;
+EXPORT_SYMBOL(fp_counters);
+
+static unsigned int fp_counters_slots = 16384;
+static unsigned long fp_counters_size;
+static unsigned long *fp_counters_map;
+static unsigned int fp_counters_used;
+static unsigned int fp_counters_hint = 1;
+static DEFINE_SPINLOCK(fp_counters_lock);
+
+static int __init fp_counters_setup(char *str)
+{
+	unsigned long slots;
+
+	if (!kstrtoul(str, 0, &slots) && slots > 1 && slots <= (1 << 24))
+		fp_counters_slots = slots;
+	return 1;
+}
+__setup("fp_counters=", fp_counters_setup);
+
+/* returns 0 when there is no free slot, fp_counter_add ignores slot 0 */
+u32 fp_counter_alloc(void)
+{
+	u32 slot;
+	int cpu;
+
+	if (ACCESS_ONCE(fp_counters_used) + 1 >= fp_counters.nr_slots)
+		return 0;
+
+	spin_lock_bh(&fp_counters_lock);
+	slot = find_next_zero_bit(fp_counters_map, fp_counters.nr_slots,
+				  fp_counters_hint);
+	if (slot >= fp_counters.nr_slots)
+		slot = find_next_zero_bit(fp_counters_map,
+					  fp_counters.nr_slots, 1);
+	if (slot >= fp_counters.nr_slots) {
+		spin_unlock_bh(&fp_counters_lock);
+		return 0;
+	}
+	__set_bit(slot, fp_counters_map);
+	++fp_counters_used;
+	fp_counters_hint = slot + 1;
+	spin_unlock_bh(&fp_counters_lock);
+
+	/* nobody writes a free slot, clear what the previous owner left */
+	for_each_possible_cpu(cpu) {
+		struct fp_counter *c = fp_counter_ptr(cpu, slot);
+
+		c->seq++;
+		smp_wmb();
+		c->packets = 0;
+		c->bytes = 0;
+		c->gen++;
+		smp_wmb();
+		c->seq++;
+	}
+	return slot;
+}
+EXPORT_SYMBOL(fp_counter_alloc);
+
+void fp_counter_free(u32 slot)
+{
+	if (!slot)
+		return;
+
+	spin_lock_bh(&fp_counters_lock);
+	__clear_bit(slot, fp_counters_map);
+	--fp_counters_used;
+	spin_unlock_bh(&fp_counters_lock);
+}
+EXPORT_SYMBOL(fp_counter_free);
+
+void fp_counter_read(u32 slot, u64 *packets, u64 *bytes)
+{
+	int cpu;
+
+	*packets = 0;
+	*bytes = 0;
+	if (!slot)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		const struct fp_counter *c = fp_counter_ptr(cpu, slot);
+		u64 p, b;
+		u32 seq;
+
+		do {
+			seq = ACCESS_ONCE(c->seq);
+			smp_rmb();
+			p = c->packets;
+			b = c->bytes;
+			smp_rmb();
+		} while ((seq & 1) || seq != ACCESS_ONCE(c->seq));
+
+		*packets += p;
+		*bytes += b;
+	}
+}
+EXPORT_SYMBOL(fp_counter_read);
+
+/* the folded per interface stats plus what was counted in the page */
+void fp_dev_read_counters(const struct net_device *dev,
+			  u64 *rx_packets, u64 *rx_bytes,
+			  u64 *tx_packets, u64 *tx_bytes)
+{
+	fp_counter_read(dev->fp.rx_counter, rx_packets, rx_bytes);
+	fp_counter_read(dev->fp.tx_counter, tx_packets, tx_bytes);
+	*rx_packets += dev->fp.fp_rx_packet;
+	*rx_bytes += dev->fp.fp_rx_byte;
+	*tx_packets += dev->fp.fp_tx_packet;
+	*tx_bytes += dev->fp.fp_tx_byte;
+}
+EXPORT_SYMBOL(fp_dev_read_counters);
+
+static int fp_counters_mmap(struct file *filp, struct kobject *kobj,
+			    struct bin_attribute *attr,
+			    struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, fp_counters.base, vma->vm_pgoff);
+}
+
+static ssize_t fp_counters_bin_read(struct file *filp, struct kobject *kobj,
+				    struct bin_attribute *attr,
+				    char *buf, loff_t off, size_t count)
+{
+	if (off >= fp_counters_size)
+		return 0;
+	if (count > fp_counters_size - off)
+		count = fp_counters_size - off;
+	memcpy(buf, fp_counters.base + off, count);
+	return count;
+}
+
+static struct bin_attribute fp_counters_attr = {
+	.attr = { .name = "fp_counters", .mode = S_IRUSR },
+	.read = fp_counters_bin_read,
+	.mmap = fp_counters_mmap,
+};
+
+static int __init fp_counters_init(void)
+{
+	struct fp_counters_info *info;
+	unsigned long stride;
+
+	stride = PAGE_ALIGN(fp_counters_slots * sizeof(struct fp_counter));
+	fp_counters_size = PAGE_SIZE + nr_cpu_ids * stride;
+	fp_counters_map = kzalloc(BITS_TO_LONGS(fp_counters_slots) *
+				  sizeof(unsigned long), GFP_KERNEL);
+	fp_counters.base = vmalloc_user(fp_counters_size);
+	if (!fp_counters.base || !fp_counters_map) {
+		pr_err("fp_counters: cannot allocate %u slots\n",
+		       fp_counters_slots);
+		vfree(fp_counters.base);
+		kfree(fp_counters_map);
+		fp_counters.base = NULL;
+		return -ENOMEM;
+	}
+
+	fp_counters.cpu_offset = PAGE_SIZE;
+	fp_counters.cpu_stride = stride;
+	fp_counters.nr_slots = fp_counters_slots;
+
+	info = fp_counters.base;
+	info->magic = FP_COUNTERS_MAGIC;
+	info->version = FP_COUNTERS_VERSION;
+	info->nr_cpus = nr_cpu_ids;
+	info->nr_slots = fp_counters_slots;
+	info->slot_size = sizeof(struct fp_counter);
+	info->cpu_offset = fp_counters.cpu_offset;
+	info->cpu_stride = stride;
+	return 0;
+}
+core_initcall(fp_counters_init);
+
+static int __init fp_counters_sysfs_init(void)
+{
+	if (!fp_counters.base)
+		return 0;
+	fp_counters_attr.size = fp_counters_size;
+	return sysfs_create_bin_file(kernel_kobj, &fp_counters_attr);
+}
+device_initcall(fp_counters_sysfs_init);
@@ -36,6 +36,7 @@
 #include <linux/random.h>
 #include <linux/string.h>
 #include <linux/log2.h>
+#include <linux/vmalloc.h>
 
 #define NEIGH_DEBUG 1
 
@@ -55,6 +56,13 @@
 
 #define PNEIGH_HASHMASK		0xF
 
+/* States aged by n->timer; NUD_REACHABLE is aged by neigh_periodic_work */
+#define NUD_TIMED		(NUD_IN_TIMER & ~NUD_REACHABLE)
+
+#define NEIGH_HASH_MIN_SHIFT	3
+#define NEIGH_FORCED_GC_BUCKETS	256U
+#define NEIGH_GC_NOTIFY		16
+
 static void neigh_timer_handler(unsigned long arg);
 static void __neigh_notify(struct neighbour *n, int type, int flags);
 static void neigh_update_notify(struct neighbour *neigh);
@@ -129,10 +137,15 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
 
+/*
+ * Runs from neigh_alloc() in softirq, so it only scans a bounded number
+ * of buckets per call, resuming where the previous call stopped, and
+ * quits as soon as the table is back under gc_thresh2.
+ */
 static int neigh_forced_gc(struct neigh_table *tbl)
 {
 	int shrunk = 0;
-	int i;
+	unsigned int i, budget;
 	struct neigh_hash_table *nht;
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
@@ -140,20 +153,26 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 	write_lock_bh(&tbl->lock);
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
-	for (i = 0; i < (1 << nht->hash_shift); i++) {
+	budget = min(1U << nht->hash_shift, NEIGH_FORCED_GC_BUCKETS);
+	while (budget-- &&
+	       atomic_read(&tbl->entries) >= tbl->gc_thresh2) {
 		struct neighbour *n;
 		struct neighbour __rcu **np;
 
+		i = tbl->forced_gc_bucket++ & ((1 << nht->hash_shift) - 1);
+
 		np = &nht->hash_buckets[i];
 		while ((n = rcu_dereference_protected(*np,
 					lockdep_is_held(&tbl->lock))) != NULL) {
 			/* Neighbour record may be discarded if:
 			 * - nobody refers to it.
 			 * - it is not permanent
+			 * - it is not reachable (those no longer pin
+			 *   themselves with a timer)
 			 */
 			write_lock(&n->lock);
 			if (atomic_read(&n->refcnt) == 1 &&
-			    !(n->nud_state & NUD_PERMANENT)) {
+			    !(n->nud_state & (NUD_PERMANENT | NUD_REACHABLE))) {
 				rcu_assign_pointer(*np,
 					rcu_dereference_protected(n->next,
 						  lockdep_is_held(&tbl->lock)));
@@ -178,13 +197,7 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 static void neigh_add_timer(struct neighbour *n, unsigned long when)
 {
 	neigh_hold(n);
-	if (!timer_pending(&n->timer)) {
-	    unsigned cpu = get_random_int() % num_online_cpus();
-	    n->timer.expires = when;
-	    add_timer_on(&n->timer, cpu);
-	}
-	else {
-//	if (unlikely(mod_timer(&n->timer, when))) {
+	if (unlikely(mod_timer(&n->timer, when))) {
 		printk("NEIGH: BUG, double timer add, state is %x\n",
 		       n->nud_state);
 		dump_stack();
@@ -344,15 +357,18 @@ static struct neigh_hash_table *neigh_hash_alloc(unsigned int shift)
 	struct neighbour __rcu **buckets;
 	int i;
 
-	ret = kmalloc(sizeof(*ret), GFP_ATOMIC);
+	ret = kmalloc(sizeof(*ret), GFP_KERNEL);
 	if (!ret)
 		return NULL;
 	if (size <= PAGE_SIZE)
-		buckets = kzalloc(size, GFP_ATOMIC);
-	else
+		buckets = kzalloc(size, GFP_KERNEL);
+	else {
 		buckets = (struct neighbour __rcu **)
-			  __get_free_pages(GFP_ATOMIC | __GFP_ZERO,
-					   get_order(size));
+			  __get_free_pages(GFP_KERNEL | __GFP_ZERO |
+					   __GFP_NOWARN, get_order(size));
+		if (!buckets)
+			buckets = vzalloc(size);
+	}
 	if (!buckets) {
 		kfree(ret);
 		return NULL;
@@ -364,34 +380,60 @@ static struct neigh_hash_table *neigh_hash_alloc(unsigned int shift)
 	return ret;
 }
 
-static void neigh_hash_free_rcu(struct rcu_head *head)
+/* Readers must be gone, buckets may be vmalloc()ed. */
+static void neigh_hash_free(struct neigh_hash_table *nht)
 {
-	struct neigh_hash_table *nht = container_of(head,
-						    struct neigh_hash_table,
-						    rcu);
 	size_t size = (1 << nht->hash_shift) * sizeof(struct neighbour *);
 	struct neighbour __rcu **buckets = nht->hash_buckets;
 
 	if (size <= PAGE_SIZE)
 		kfree(buckets);
+	else if (is_vmalloc_addr(buckets))
+		vfree(buckets);
 	else
 		free_pages((unsigned long)buckets, get_order(size));
 	kfree(nht);
 }
 
-static struct neigh_hash_table *neigh_hash_grow(struct neigh_table *tbl,
-						unsigned long new_shift)
+/*
+ * Lookups are lockless, so resizing only has to keep the writers out
+ * while the entries are relinked.  Done from a work item so neither
+ * neigh_create() in softirq nor the big allocation run with BHs off.
+ * It is queued on system_nrt_wq, so two cpus never resize at once.
+ */
+static void neigh_hash_resize(struct work_struct *work)
 {
-	unsigned int i, hash;
+	struct neigh_table *tbl = container_of(work, struct neigh_table,
+					       hash_work);
+	unsigned int i, hash, shift, entries;
 	struct neigh_hash_table *new_nht, *old_nht;
 
-	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
+	/* only this work and neigh_table_clear() replace tbl->nht */
+	old_nht = rcu_dereference_protected(tbl->nht, 1);
+	entries = atomic_read(&tbl->entries);
+
+	shift = old_nht->hash_shift;
+	while (entries > (1U << shift))
+		shift++;
+	while (shift > NEIGH_HASH_MIN_SHIFT && (entries << 3) < (1U << shift))
+		shift--;
+	if (shift == old_nht->hash_shift)
+		return;
+
+	new_nht = neigh_hash_alloc(shift);
+	if (!new_nht)
+		return;
 
+	write_lock_bh(&tbl->lock);
 	old_nht = rcu_dereference_protected(tbl->nht,
 					    lockdep_is_held(&tbl->lock));
-	new_nht = neigh_hash_alloc(new_shift);
-	if (!new_nht)
-		return old_nht;
+	if (old_nht->hash_shift == shift) {
+		write_unlock_bh(&tbl->lock);
+		neigh_hash_free(new_nht);
+		return;
+	}
+
+	NEIGH_CACHE_STAT_INC(tbl, hash_grows);
 
 	for (i = 0; i < (1 << old_nht->hash_shift); i++) {
 		struct neighbour *n, *next;
@@ -416,8 +458,10 @@ static struct neigh_hash_table *neigh_hash_grow(struct neigh_table *tbl,
 	}
 
 	rcu_assign_pointer(tbl->nht, new_nht);
-	call_rcu(&old_nht->rcu, neigh_hash_free_rcu);
-	return new_nht;
+	write_unlock_bh(&tbl->lock);
+
+	synchronize_rcu();
+	neigh_hash_free(old_nht);
 }
 
 struct neighbour *neigh_lookup(struct neigh_table *tbl, const void *pkey,
@@ -527,7 +571,7 @@ struct neighbour *neigh_create(struct neigh_table *tbl, const void *pkey,
 					lockdep_is_held(&tbl->lock));
 
 	if (atomic_read(&tbl->entries) > (1 << nht->hash_shift))
-		nht = neigh_hash_grow(tbl, nht->hash_shift + 1);
+		queue_work(system_nrt_wq, &tbl->hash_work);
 
 	hash_val = tbl->hash(pkey, dev, nht->hash_rnd) >> (32 - nht->hash_shift);
 
@@ -770,13 +814,49 @@ static void neigh_connect(struct neighbour *neigh)
 	neigh->output = neigh->ops->connected_output;
 }
 
+/*
+ * REACHABLE entries carry no timer of their own; the periodic work
+ * ages them here.  Returns 1 if the caller should send a notification.
+ */
+static int neigh_reachable_expire(struct neighbour *neigh, unsigned long now)
+{
+	if (time_before_eq(now,
+			   neigh->confirmed + neigh->parms->reachable_time))
+		return 0;
+
+	if (time_before_eq(now, neigh->used + neigh->parms->delay_probe_time)) {
+		NEIGH_PRINTK2("neigh %p is delayed.\n", neigh);
+		neigh->nud_state = NUD_DELAY;
+		neigh->updated = now;
+		neigh_suspect(neigh);
+		neigh_add_timer(neigh, now + neigh->parms->delay_probe_time);
+		return 0;
+	}
+
+	NEIGH_PRINTK2("neigh %p is suspected.\n", neigh);
+	neigh->nud_state = NUD_STALE;
+	neigh->updated = now;
+	neigh_suspect(neigh);
+	return 1;
+}
+
+/*
+ * Runs every second and walks a slice of the hash sized so that the
+ * whole table is covered once per base_reachable_time/2, taking the
+ * shortest one of the table's parms.  A REACHABLE entry is demoted only
+ * when its bucket comes up, so up to that half period after its
+ * reachable_time ran out: 15s with the default base_reachable_time.
+ */
 static void neigh_periodic_work(struct work_struct *work)
 {
 	struct neigh_table *tbl = container_of(work, struct neigh_table, gc_work.work);
+	struct neighbour *notify[NEIGH_GC_NOTIFY];
 	struct neighbour *n;
 	struct neighbour __rcu **np;
-	unsigned int i;
+	unsigned int i, budget, n_buckets, n_notify;
+	unsigned long period, now;
 	struct neigh_hash_table *nht;
+	struct neigh_parms *p;
 
 	NEIGH_CACHE_STAT_INC(tbl, periodic_gc_runs);
 
@@ -789,15 +869,31 @@ static void neigh_periodic_work(struct work_struct *work)
 	 */
 
 	if (time_after(jiffies, tbl->last_rand + 300 * HZ)) {
-		struct neigh_parms *p;
 		tbl->last_rand = jiffies;
 		for (p = &tbl->parms; p; p = p->next)
 			p->reachable_time =
 				neigh_rand_reach_time(p->base_reachable_time);
 	}
 
-	for (i = 0 ; i < (1 << nht->hash_shift); i++) {
+	period = tbl->parms.base_reachable_time;
+	for (p = tbl->parms.next; p; p = p->next)
+		if (p->base_reachable_time &&
+		    p->base_reachable_time < period)
+			period = p->base_reachable_time;
+
+	n_buckets = 1 << nht->hash_shift;
+	period = (period >> 1) / HZ;
+	budget = n_buckets / max(period, 1UL) + 1;
+
+	if (nht->hash_shift > NEIGH_HASH_MIN_SHIFT &&
+	    (atomic_read(&tbl->entries) << 3) < n_buckets)
+		queue_work(system_nrt_wq, &tbl->hash_work);
+
+	while (budget--) {
+		i = tbl->gc_bucket & (n_buckets - 1);
 		np = &nht->hash_buckets[i];
+		n_notify = 0;
+		now = jiffies;
 
 		while ((n = rcu_dereference_protected(*np,
 				lockdep_is_held(&tbl->lock))) != NULL) {
@@ -806,7 +902,18 @@ static void neigh_periodic_work(struct work_struct *work)
 			write_lock(&n->lock);
 
 			state = n->nud_state;
-			if (state & (NUD_PERMANENT | NUD_IN_TIMER)) {
+			if (state & NUD_REACHABLE) {
+				/* no room to notify a demotion: leave the
+				 * rest of the bucket for the next pass */
+				if (n_notify < NEIGH_GC_NOTIFY &&
+				    neigh_reachable_expire(n, now)) {
+					neigh_hold(n);
+					notify[n_notify++] = n;
+				}
+				write_unlock(&n->lock);
+				goto next_elt;
+			}
+			if (state & (NUD_PERMANENT | NUD_TIMED)) {
 				write_unlock(&n->lock);
 				goto next_elt;
 			}
@@ -816,7 +923,7 @@ static void neigh_periodic_work(struct work_struct *work)
 
 			if (atomic_read(&n->refcnt) == 1 &&
 			    (state == NUD_FAILED ||
-			     time_after(jiffies, n->used + n->parms->gc_staletime))) {
+			     time_after(now, n->used + n->parms->gc_staletime))) {
 				*np = n->next;
 				n->dead = 1;
 				write_unlock(&n->lock);
@@ -828,22 +935,25 @@ static void neigh_periodic_work(struct work_struct *work)
 next_elt:
 			np = &n->next;
 		}
+		if (n_notify < NEIGH_GC_NOTIFY)
+			tbl->gc_bucket++;
 		/*
 		 * It's fine to release lock here, even if hash table
-		 * grows while we are preempted.
+		 * is resized while we are preempted.
 		 */
 		write_unlock_bh(&tbl->lock);
+		while (n_notify) {
+			n = notify[--n_notify];
+			neigh_update_notify(n);
+			neigh_release(n);
+		}
 		cond_resched();
 		write_lock_bh(&tbl->lock);
 		nht = rcu_dereference_protected(tbl->nht,
 						lockdep_is_held(&tbl->lock));
+		n_buckets = 1 << nht->hash_shift;
 	}
-	/* Cycle through all hash buckets every base_reachable_time/2 ticks.
-	 * ARP entry timeouts range from 1/2 base_reachable_time to 3/2
-	 * base_reachable_time.
-	 */
-	schedule_delayed_work(&tbl->gc_work,
-			      tbl->parms.base_reachable_time >> 1);
+	schedule_delayed_work(&tbl->gc_work, HZ);
 	write_unlock_bh(&tbl->lock);
 }
 
@@ -908,29 +1018,10 @@ static void neigh_timer_handler(unsigned long arg)
 	now = jiffies;
 	next = now + HZ;
 
-	if (!(state & NUD_IN_TIMER))
+	if (!(state & NUD_TIMED))
 		goto out;
 
-	if (state & NUD_REACHABLE) {
-		if (time_before_eq(now,
-				   neigh->confirmed + neigh->parms->reachable_time)) {
-			NEIGH_PRINTK2("neigh %p is still alive.\n", neigh);
-			next = neigh->confirmed + neigh->parms->reachable_time;
-		} else if (time_before_eq(now,
-					  neigh->used + neigh->parms->delay_probe_time)) {
-			NEIGH_PRINTK2("neigh %p is delayed.\n", neigh);
-			neigh->nud_state = NUD_DELAY;
-			neigh->updated = jiffies;
-			neigh_suspect(neigh);
-			next = now + neigh->parms->delay_probe_time;
-		} else {
-			NEIGH_PRINTK2("neigh %p is suspected.\n", neigh);
-			neigh->nud_state = NUD_STALE;
-			neigh->updated = jiffies;
-			neigh_suspect(neigh);
-			notify = 1;
-		}
-	} else if (state & NUD_DELAY) {
+	if (state & NUD_DELAY) {
 		if (time_before_eq(now,
 				   neigh->confirmed + neigh->parms->delay_probe_time)) {
 			NEIGH_PRINTK2("neigh %p is now reachable.\n", neigh);
@@ -938,7 +1029,6 @@ static void neigh_timer_handler(unsigned long arg)
 			neigh->updated = jiffies;
 			neigh_connect(neigh);
 			notify = 1;
-			next = neigh->confirmed + neigh->parms->reachable_time;
 		} else {
 			NEIGH_PRINTK2("neigh %p is probed.\n", neigh);
 			neigh->nud_state = NUD_PROBE;
@@ -958,7 +1048,7 @@ static void neigh_timer_handler(unsigned long arg)
 		neigh_invalidate(neigh);
 	}
 
-	if (neigh->nud_state & NUD_IN_TIMER) {
+	if (neigh->nud_state & NUD_TIMED) {
 		if (time_before(next, jiffies + HZ/2))
 			next = jiffies + HZ/2;
 		if (!mod_timer(&neigh->timer, next))
@@ -1171,11 +1261,8 @@ int neigh_update(struct neighbour *neigh, const u8 *lladdr, u8 new,
 
 	if (new != old) {
 		neigh_del_timer(neigh);
-		if (new & NUD_IN_TIMER)
-			neigh_add_timer(neigh, (jiffies +
-						((new & NUD_REACHABLE) ?
-						 neigh->parms->reachable_time :
-						 0)));
+		if (new & NUD_TIMED)
+			neigh_add_timer(neigh, jiffies);
 		neigh->nud_state = new;
 	}
 
@@ -1536,6 +1623,7 @@ void neigh_table_init_no_netlink(struct neigh_table *tbl)
 		panic("cannot allocate neighbour cache hashes");
 
 	rwlock_init(&tbl->lock);
+	INIT_WORK(&tbl->hash_work, neigh_hash_resize);
 	INIT_DELAYED_WORK_DEFERRABLE(&tbl->gc_work, neigh_periodic_work);
 	schedule_delayed_work(&tbl->gc_work, tbl->parms.reachable_time);
 	setup_timer(&tbl->proxy_timer, neigh_proxy_process, (unsigned long)tbl);
@@ -1578,6 +1666,7 @@ int neigh_table_clear(struct neigh_table *tbl)
 	del_timer_sync(&tbl->proxy_timer);
 	pneigh_queue_purge(&tbl->proxy_queue);
 	neigh_ifdown(tbl, NULL);
+	cancel_work_sync(&tbl->hash_work);
 	if (atomic_read(&tbl->entries))
 		printk(KERN_CRIT "neighbour leakage\n");
 	write_lock(&neigh_tbl_lock);
@@ -1589,8 +1678,8 @@ int neigh_table_clear(struct neigh_table *tbl)
 	}
 	write_unlock(&neigh_tbl_lock);
 
-	call_rcu(&rcu_dereference_protected(tbl->nht, 1)->rcu,
-		 neigh_hash_free_rcu);
+	synchronize_rcu();
+	neigh_hash_free(rcu_dereference_protected(tbl->nht, 1));
 	tbl->nht = NULL;
 
 	kfree(tbl->phash_buckets);
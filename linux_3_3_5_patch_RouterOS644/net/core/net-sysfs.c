@@ -306,6 +306,18 @@ static ssize_t store_group(struct device *dev, struct device_attribute *attr,
 	return netdev_store(dev, attr, buf, len, change_group);
 }
 
+static ssize_t format_fp_counters(const struct net_device *net, char *buf)
+{
+	return sprintf(buf, "%u %u\n", net->fp.rx_counter, net->fp.tx_counter);
+}
+
+/* rx and tx slot of this device in /sys/kernel/fp_counters */
+static ssize_t show_fp_counters(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	return netdev_show(dev, attr, buf, format_fp_counters);
+}
+
 static struct device_attribute net_class_attributes[] = {
 	__ATTR(addr_assign_type, S_IRUGO, show_addr_assign_type, NULL),
 	__ATTR(addr_len, S_IRUGO, show_addr_len, NULL),
@@ -327,6 +339,7 @@ static struct device_attribute net_class_attributes[] = {
 	__ATTR(tx_queue_len, S_IRUGO | S_IWUSR, show_tx_queue_len,
 	       store_tx_queue_len),
 	__ATTR(netdev_group, S_IRUGO | S_IWUSR, show_group, store_group),
+	__ATTR(fp_counters, S_IRUGO, show_fp_counters, NULL),
 	{}
 };
 
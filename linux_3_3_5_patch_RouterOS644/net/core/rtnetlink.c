@@ -50,8 +50,10 @@
 #include <net/sock.h>
 #include <net/pkt_sched.h>
 #include <net/fib_rules.h>
+#include <net/ip_fib.h>
 #include <net/rtnetlink.h>
 #include <net/net_namespace.h>
+#include <linux/fp_counters.h>
 
 struct rtnl_link {
 	rtnl_doit_func		doit;
@@ -885,6 +887,7 @@ static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 	ASSERT_RTNL();
 	if (ext_filter_mask & RTEXT_FILTER_COMPACT) {
 		struct rtnl_link_compact *lc;
+		u64 fp_rx_packets, fp_rx_bytes, fp_tx_packets, fp_tx_bytes;
 		nlh = nlmsg_put(skb, pid, seq, type, sizeof(*lc), flags);
 		if (nlh == NULL)
 			return -EMSGSIZE;
@@ -906,10 +909,12 @@ static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 		lc->stats.tx_bytes = stats->tx_bytes;
 		lc->stats.tx_drops = stats->tx_dropped;
 		lc->stats.tx_errors = stats->tx_errors;
-		lc->stats.fp_rx_packets = dev->fp.fp_rx_packet;
-		lc->stats.fp_tx_packets = dev->fp.fp_tx_packet;
-		lc->stats.fp_rx_bytes = dev->fp.fp_rx_byte;
-		lc->stats.fp_tx_bytes = dev->fp.fp_tx_byte;
+		fp_dev_read_counters(dev, &fp_rx_packets, &fp_rx_bytes,
+				     &fp_tx_packets, &fp_tx_bytes);
+		lc->stats.fp_rx_packets = fp_rx_packets;
+		lc->stats.fp_tx_packets = fp_tx_packets;
+		lc->stats.fp_rx_bytes = fp_rx_bytes;
+		lc->stats.fp_tx_bytes = fp_tx_bytes;
 		lc->stats.tx_queue_drops = dev->fp.queue_stopped_drop + dev->qdisc->qstats.drops;
 		return nlmsg_end(skb, nlh);
 	}
@@ -2099,6 +2104,9 @@ static void rtnetlink_rcv(struct sk_buff *skb)
 {
 	rtnl_lock();
 	netlink_rcv_skb(skb, &rtnetlink_rcv_msg);
+#ifdef CONFIG_INET
+	fib_batch_commit(sock_net(skb->sk));
+#endif
 	rtnl_unlock();
 }
 
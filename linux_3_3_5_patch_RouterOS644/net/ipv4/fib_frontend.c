@@ -561,6 +561,42 @@ errout:
 	return err;
 }
 
+/*
+ * Route messages sent to us in one go (several RTM_NEWROUTE/RTM_DELROUTE
+ * in a single skb, as routing daemons do on a full table load) form a
+ * batch: the trie is rebalanced and ipv4_routing_changed() is called once
+ * when rtnetlink_rcv() is done with the skb instead of once per route.
+ */
+static void fib_batch_begin(struct sk_buff *skb, struct nlmsghdr *nlh)
+{
+	if (skb->len > NLMSG_ALIGN(nlh->nlmsg_len))
+		sock_net(skb->sk)->ipv4.fib_batch = true;
+}
+
+/* Caller must hold RTNL. */
+void fib_batch_commit(struct net *net)
+{
+	struct fib_table *tb;
+	struct hlist_node *node;
+	unsigned int h;
+
+	if (!net->ipv4.fib_batch)
+		return;
+	net->ipv4.fib_batch = false;
+
+	for (h = 0; h < FIB_TABLE_HASHSZ; h++) {
+		hlist_for_each_entry(tb, node, &net->ipv4.fib_table_hash[h],
+				     tb_hlist)
+			fib_table_commit(tb);
+	}
+
+	if (net->ipv4.fib_batch_changed) {
+		net->ipv4.fib_batch_changed = false;
+		if (ipv4_routing_changed)
+			ipv4_routing_changed();
+	}
+}
+
 static int inet_rtm_delroute(struct sk_buff *skb, struct nlmsghdr *nlh, void *arg)
 {
 	struct net *net = sock_net(skb->sk);
@@ -572,6 +608,7 @@ static int inet_rtm_delroute(struct sk_buff *skb, struct nlmsghdr *nlh, void *ar
 	if (err < 0)
 		goto errout;
 
+	fib_batch_begin(skb, nlh);
 	tb = fib_get_table(net, cfg.fc_table);
 	if (tb == NULL) {
 		err = -ESRCH;
@@ -594,6 +631,7 @@ static int inet_rtm_newroute(struct sk_buff *skb, struct nlmsghdr *nlh, void *ar
 	if (err < 0)
 		goto errout;
 
+	fib_batch_begin(skb, nlh);
 	tb = fib_new_table(net, cfg.fc_table);
 	if (tb == NULL) {
 		err = -ENOBUFS;
@@ -180,6 +180,10 @@ void fib_release_info(struct fib_info *fi)
 			hlist_del(&nexthop_nh->nh_hash);
 		} endfor_nexthops(fi)
 		fi->fib_dead = 1;
+		/* xchg() in the flush orders this against rt_nh_cache_input() */
+		change_nexthops(fi) {
+			rt_nh_flush_input(nexthop_nh);
+		} endfor_nexthops(fi)
 		fib_info_put(fi);
 	}
 	spin_unlock_bh(&fib_info_lock);
@@ -1068,6 +1072,9 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 		prev_fi = fi;
 		dead = 0;
 		change_nexthops(fi) {
+			/* cached input routes hold a reference on the device */
+			if (nexthop_nh->nh_dev == dev)
+				rt_nh_flush_input(nexthop_nh);
 			if (nexthop_nh->nh_flags & RTNH_F_DEAD)
 				dead++;
 			else if (nexthop_nh->nh_dev == dev &&
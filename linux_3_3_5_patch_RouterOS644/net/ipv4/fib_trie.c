@@ -72,6 +72,7 @@
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/export.h>
 #include <net/net_namespace.h>
 #include <net/ip.h>
@@ -121,6 +122,7 @@ struct tnode {
 	t_key key;
 	unsigned char pos;		/* 2log(KEYLENGTH) bits needed */
 	unsigned char bits;		/* 2log(KEYLENGTH) bits needed */
+	unsigned char dirty;		/* resize deferred by a batch */
 	unsigned int full_children;	/* KEYLENGTH bits needed */
 	unsigned int empty_children;	/* KEYLENGTH bits needed */
 	union {
@@ -139,6 +141,8 @@ struct trie_use_stats {
 	unsigned int semantic_match_miss;
 	unsigned int null_node_hit;
 	unsigned int resize_node_skipped;
+	unsigned int dir_hit;
+	unsigned int dir_fallback;
 };
 #endif
 
@@ -152,8 +156,37 @@ struct trie_stat {
 	unsigned int nodesizes[MAX_STAT_DEPTH];
 };
 
+/*
+ * Read side copy of a big trie: a DIR-16-8-8 table mapping every address
+ * straight to the leaf_info of its longest matching prefix.  Entries are
+ * either a leaf_info pointer (NULL if no prefix covers the address) or a
+ * pointer to the next level chunk tagged with FIB_DIR_CHUNK_BIT, so a
+ * lookup costs at most three dependent loads from contiguous memory.
+ * Updated in place under RTNL along with the trie.
+ */
+#define FIB_DIR_MIN_PREFIXES	1024
+#define FIB_DIR_TOP_BITS	16
+#define FIB_DIR_CHUNK_BITS	8
+#define FIB_DIR_CHUNK_SIZE	(1 << FIB_DIR_CHUNK_BITS)
+#define FIB_DIR_CHUNK_BIT	0x1UL
+
+struct fib_dir_chunk {
+	unsigned long ent[FIB_DIR_CHUNK_SIZE];
+	struct rcu_head rcu;
+};
+
+struct fib_dir {
+	unsigned int chunks;
+	unsigned long ent[1 << FIB_DIR_TOP_BITS];
+};
+
 struct trie {
 	struct rt_trie_node __rcu *trie;
+	struct fib_dir __rcu *dir;
+	unsigned int prefixes;
+	unsigned int dir_threshold;
+	bool batching;		/* inside a netlink route batch */
+	bool rebalance_pending;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	struct trie_use_stats stats;
 #endif
@@ -165,6 +198,8 @@ static void tnode_put_child_reorg(struct tnode *tn, int i, struct rt_trie_node *
 static struct rt_trie_node *resize(struct trie *t, struct tnode *tn);
 static struct tnode *inflate(struct trie *t, struct tnode *tn);
 static struct tnode *halve(struct trie *t, struct tnode *tn);
+static struct leaf *trie_firstleaf(struct trie *t);
+static struct leaf *trie_nextleaf(struct leaf *l);
 /* tnodes to free after resize(); protected by RTNL */
 static struct tnode *tnode_free_head;
 static size_t tnode_free_size;
@@ -178,6 +213,7 @@ static const int sync_pages = 128;
 
 static struct kmem_cache *fn_alias_kmem __read_mostly;
 static struct kmem_cache *trie_leaf_kmem __read_mostly;
+static struct kmem_cache *fib_dir_kmem __read_mostly;
 
 /*
  * caller must hold RTNL
@@ -999,6 +1035,21 @@ static void trie_rebalance(struct trie *t, struct tnode *tn)
 	t_key cindex, key;
 	struct tnode *tp;
 
+	/*
+	 * An unbalanced trie is still a valid one, so a batch leaves the
+	 * resizing to fib_table_commit() instead of doing it per route.
+	 * The changed tnode and its ancestors are marked for it, those
+	 * above a marked one already are.
+	 */
+	if (t->batching) {
+		while (tn && !tn->dirty) {
+			tn->dirty = 1;
+			tn = node_parent((struct rt_trie_node *)tn);
+		}
+		t->rebalance_pending = true;
+		return;
+	}
+
 	key = tn->key;
 
 	while (tn != NULL && (tp = node_parent((struct rt_trie_node *)tn)) != NULL) {
@@ -1027,6 +1078,267 @@ static void trie_rebalance(struct trie *t, struct tnode *tn)
 	tnode_free_flush();
 }
 
+static inline unsigned long fib_dir_get(const unsigned long *ent)
+{
+	unsigned long v = ACCESS_ONCE(*ent);
+
+	smp_read_barrier_depends();
+	return v;
+}
+
+static inline void fib_dir_set(unsigned long *ent, unsigned long v)
+{
+	smp_wmb();
+	*ent = v;
+}
+
+static inline struct fib_dir_chunk *fib_dir_chunk(unsigned long v)
+{
+	return (struct fib_dir_chunk *)(v & ~FIB_DIR_CHUNK_BIT);
+}
+
+/* rcu_read_lock needs to be hold by caller */
+static inline struct leaf_info *fib_dir_lookup(const struct fib_dir *dir,
+					       t_key key)
+{
+	unsigned long v = fib_dir_get(&dir->ent[key >> 16]);
+
+	if (v & FIB_DIR_CHUNK_BIT) {
+		v = fib_dir_get(&fib_dir_chunk(v)->ent[(key >> 8) & 0xff]);
+		if (v & FIB_DIR_CHUNK_BIT)
+			v = fib_dir_get(&fib_dir_chunk(v)->ent[key & 0xff]);
+	}
+	return (struct leaf_info *)v;
+}
+
+static void __fib_dir_chunk_free_rcu(struct rcu_head *head)
+{
+	struct fib_dir_chunk *c = container_of(head, struct fib_dir_chunk, rcu);
+	kmem_cache_free(fib_dir_kmem, c);
+}
+
+/* Make *ent point to a chunk, splitting the value it holds if needed. */
+static struct fib_dir_chunk *fib_dir_split(struct fib_dir *dir,
+					   unsigned long *ent, bool create)
+{
+	struct fib_dir_chunk *c;
+	unsigned long v = *ent;
+	int i;
+
+	if (v & FIB_DIR_CHUNK_BIT)
+		return fib_dir_chunk(v);
+	if (!create)
+		return NULL;
+
+	c = kmem_cache_alloc(fib_dir_kmem, GFP_KERNEL);
+	if (!c)
+		return ERR_PTR(-ENOMEM);
+	for (i = 0; i < FIB_DIR_CHUNK_SIZE; i++)
+		c->ent[i] = v;
+	dir->chunks++;
+	fib_dir_set(ent, (unsigned long)c | FIB_DIR_CHUNK_BIT);
+	return c;
+}
+
+/* Fold a chunk whose entries all became equal back into *ent. */
+static void fib_dir_collapse(struct fib_dir *dir, unsigned long *ent)
+{
+	struct fib_dir_chunk *c = fib_dir_chunk(*ent);
+	unsigned long v = c->ent[0];
+	int i;
+
+	if (v & FIB_DIR_CHUNK_BIT)
+		return;
+	for (i = 1; i < FIB_DIR_CHUNK_SIZE; i++)
+		if (c->ent[i] != v)
+			return;
+
+	fib_dir_set(ent, v);
+	dir->chunks--;
+	call_rcu(&c->rcu, __fib_dir_chunk_free_rcu);
+}
+
+/*
+ * Point entries covered by a prefix at @new.  On insert (@old == NULL)
+ * only entries held by shorter prefixes are taken over, on removal only
+ * the entries of @old are handed to its covering prefix @new.
+ */
+static void fib_dir_fill(struct fib_dir *dir, unsigned long *ent,
+			 unsigned int n, struct leaf_info *old,
+			 struct leaf_info *new)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		unsigned long v = ent[i];
+
+		if (v & FIB_DIR_CHUNK_BIT) {
+			fib_dir_fill(dir, fib_dir_chunk(v)->ent,
+				     FIB_DIR_CHUNK_SIZE, old, new);
+			fib_dir_collapse(dir, &ent[i]);
+			continue;
+		}
+		if (old ? v == (unsigned long)old :
+		    !v || ((struct leaf_info *)v)->plen < new->plen)
+			fib_dir_set(&ent[i], (unsigned long)new);
+	}
+}
+
+static int fib_dir_update(struct fib_dir *dir, t_key key, int plen,
+			  struct leaf_info *old, struct leaf_info *new)
+{
+	struct fib_dir_chunk *c1, *c2;
+	unsigned long *e1, *e2;
+
+	if (plen <= FIB_DIR_TOP_BITS) {
+		fib_dir_fill(dir, &dir->ent[key >> 16],
+			     1 << (FIB_DIR_TOP_BITS - plen), old, new);
+		return 0;
+	}
+
+	e1 = &dir->ent[key >> 16];
+	c1 = fib_dir_split(dir, e1, !old);
+	if (IS_ERR_OR_NULL(c1))
+		return PTR_ERR(c1);
+
+	if (plen <= 24) {
+		fib_dir_fill(dir, &c1->ent[(key >> 8) & 0xff],
+			     1 << (24 - plen), old, new);
+	} else {
+		e2 = &c1->ent[(key >> 8) & 0xff];
+		c2 = fib_dir_split(dir, e2, !old);
+		if (IS_ERR_OR_NULL(c2))
+			return PTR_ERR(c2);
+		fib_dir_fill(dir, &c2->ent[key & 0xff],
+			     1 << (32 - plen), old, new);
+		fib_dir_collapse(dir, e2);
+	}
+	fib_dir_collapse(dir, e1);
+	return 0;
+}
+
+static void fib_dir_free(struct fib_dir *dir)
+{
+	unsigned long v;
+	int i, j;
+
+	for (i = 0; i < 1 << FIB_DIR_TOP_BITS; i++) {
+		v = dir->ent[i];
+		if (!(v & FIB_DIR_CHUNK_BIT))
+			continue;
+		for (j = 0; j < FIB_DIR_CHUNK_SIZE; j++)
+			if (fib_dir_chunk(v)->ent[j] & FIB_DIR_CHUNK_BIT)
+				kmem_cache_free(fib_dir_kmem,
+					fib_dir_chunk(fib_dir_chunk(v)->ent[j]));
+		kmem_cache_free(fib_dir_kmem, fib_dir_chunk(v));
+	}
+	vfree(dir);
+}
+
+/* Drop the table, lookups go back to the trie; caller must hold RTNL. */
+static void fib_dir_destroy(struct trie *t)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	if (!dir)
+		return;
+
+	RCU_INIT_POINTER(t->dir, NULL);
+	synchronize_rcu();
+	fib_dir_free(dir);
+}
+
+static void fib_dir_build(struct trie *t)
+{
+	struct fib_dir *dir;
+	struct hlist_node *node;
+	struct leaf_info *li;
+	struct leaf *l;
+
+	dir = vzalloc(sizeof(struct fib_dir));
+	if (!dir)
+		goto nomem;
+
+	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
+		hlist_for_each_entry(li, node, &l->list, hlist)
+			if (fib_dir_update(dir, l->key, li->plen, NULL, li)) {
+				fib_dir_free(dir);
+				goto nomem;
+			}
+	}
+
+	rcu_assign_pointer(t->dir, dir);
+	return;
+
+nomem:
+	/* do not retry until the table has doubled */
+	t->dir_threshold = t->prefixes * 2;
+}
+
+/* A new prefix was linked into the trie. */
+static void fib_dir_insert(struct trie *t, t_key key, struct leaf_info *li)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+
+	t->prefixes++;
+	if (!dir) {
+		if (t->prefixes >= t->dir_threshold)
+			fib_dir_build(t);
+		return;
+	}
+
+	if (fib_dir_update(dir, key, li->plen, NULL, li)) {
+		fib_dir_destroy(t);
+		t->dir_threshold = t->prefixes * 2;
+	}
+}
+
+/*
+ * A prefix was unlinked from the trie: hand its entries to the longest
+ * shorter prefix covering it before the leaf_info is freed.
+ */
+static void fib_dir_remove(struct trie *t, t_key key, struct leaf_info *li)
+{
+	struct fib_dir *dir = rtnl_dereference(t->dir);
+	struct leaf_info *cover = NULL;
+	int plen = li->plen;
+	struct leaf *l;
+
+	t->prefixes--;
+	if (!dir)
+		return;
+
+	while (!cover && --plen >= 0) {
+		l = fib_find_node(t, key & ntohl(inet_make_mask(plen)));
+		if (l)
+			cover = find_leaf_info(l, plen);
+	}
+
+	fib_dir_update(dir, key, li->plen, li, cover);
+}
+
+/* Resize the dirty tnodes of a subtree bottom up, children first. */
+static struct rt_trie_node *trie_rebalance_subtree(struct trie *t,
+						   struct tnode *tn)
+{
+	struct rt_trie_node *c;
+	int i, wasfull;
+
+	tn->dirty = 0;
+	for (i = 0; i < tnode_child_length(tn); i++) {
+		c = tnode_get_child(tn, i);
+		if (!c || IS_LEAF(c) || !((struct tnode *)c)->dirty)
+			continue;
+
+		wasfull = tnode_full(tn, c);
+		c = trie_rebalance_subtree(t, (struct tnode *)c);
+		tnode_put_child_reorg(tn, i, c, wasfull);
+		tnode_free_flush();
+	}
+
+	return resize(t, tn);
+}
+
 /* only used from updater-side */
 
 static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
@@ -1146,6 +1458,9 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		}
 
 		node_set_parent((struct rt_trie_node *)tn, tp);
+		/* keeps a dirty n reachable from fib_table_commit() */
+		if (n && IS_TNODE(n))
+			tn->dirty = ((struct tnode *)n)->dirty;
 
 		missbit = tkey_extract_bits(key, newpos, 1);
 		put_child(t, tn, missbit, (struct rt_trie_node *)l);
@@ -1170,6 +1485,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 	trie_rebalance(t, tp);
 done:
+	fib_dir_insert(t, key, li);
 	return fa_head;
 }
 
@@ -1191,6 +1507,7 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	if (plen > 32)
 		return -EINVAL;
 
+	t->batching = cfg->fc_nlinfo.nl_net->ipv4.fib_batch;
 	key = ntohl(cfg->fc_dst);
 
 	pr_debug("Insert table=%u %08x/%d\n", tb->tb_id, key, plen);
@@ -1333,7 +1650,9 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	rtmsg_fib(RTM_NEWROUTE, htonl(key), new_fa, plen, tb->tb_id,
 		  &cfg->fc_nlinfo, 0);
 succeeded:
-	if (ipv4_routing_changed) {
+	if (t->batching)
+		cfg->fc_nlinfo.nl_net->ipv4.fib_batch_changed = true;
+	else if (ipv4_routing_changed) {
 	    ipv4_routing_changed();
 	}
 	return 0;
@@ -1347,67 +1666,79 @@ err:
 }
 
 /* should be called with rcu_read_lock */
-static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
-		      t_key key,  const struct flowi4 *flp,
-		      struct fib_result *res, int fib_flags)
+static int check_leaf_info(struct fib_table *tb, struct trie *t,
+			   struct leaf_info *li, const struct flowi4 *flp,
+			   struct fib_result *res, int fib_flags)
 {
-	struct leaf_info *li;
-	struct hlist_head *hhead = &l->list;
-	struct hlist_node *node;
+	struct fib_alias *fa;
 
-	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
-		struct fib_alias *fa;
+	list_for_each_entry_rcu(fa, &li->falh, fa_list) {
+		struct fib_info *fi = fa->fa_info;
+		int nhsel, err;
 
-		if (l->key != (key & li->mask_plen))
+		if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
 			continue;
-
-		list_for_each_entry_rcu(fa, &li->falh, fa_list) {
-			struct fib_info *fi = fa->fa_info;
-			int nhsel, err;
-
-			if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
-				continue;
-			if (fi->fib_dead)
-				continue;
-			if (fa->fa_info->fib_scope < flp->flowi4_scope)
-				continue;
-			fib_alias_accessed(fa);
-			err = fib_props[fa->fa_type].error;
-			if (err) {
+		if (fi->fib_dead)
+			continue;
+		if (fa->fa_info->fib_scope < flp->flowi4_scope)
+			continue;
+		fib_alias_accessed(fa);
+		err = fib_props[fa->fa_type].error;
+		if (err) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+			t->stats.semantic_match_passed++;
 #endif
-				return err;
-			}
-			if (fi->fib_flags & RTNH_F_DEAD)
-				continue;
-			for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
-				const struct fib_nh *nh = &fi->fib_nh[nhsel];
+			return err;
+		}
+		if (fi->fib_flags & RTNH_F_DEAD)
+			continue;
+		for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
+			const struct fib_nh *nh = &fi->fib_nh[nhsel];
 
-				if (nh->nh_flags & RTNH_F_DEAD)
-					continue;
-				if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
-					continue;
+			if (nh->nh_flags & RTNH_F_DEAD)
+				continue;
+			if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
+				continue;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+			t->stats.semantic_match_passed++;
 #endif
-				res->prefixlen = li->plen;
-				res->nh_sel = nhsel;
-				res->type = fa->fa_type;
-				res->scope = fa->fa_info->fib_scope;
-				res->fi = fi;
-				res->table = tb;
-				res->fa_head = &li->falh;
-				if (!(fib_flags & FIB_LOOKUP_NOREF))
-					atomic_inc(&fi->fib_clntref);
-				return 0;
-			}
+			res->prefixlen = li->plen;
+			res->nh_sel = nhsel;
+			res->type = fa->fa_type;
+			res->scope = fa->fa_info->fib_scope;
+			res->fi = fi;
+			res->table = tb;
+			res->fa_head = &li->falh;
+			if (!(fib_flags & FIB_LOOKUP_NOREF))
+				atomic_inc(&fi->fib_clntref);
+			return 0;
 		}
+	}
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-		t->stats.semantic_match_miss++;
+	t->stats.semantic_match_miss++;
 #endif
+	return 1;
+}
+
+/* should be called with rcu_read_lock */
+static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
+		      t_key key,  const struct flowi4 *flp,
+		      struct fib_result *res, int fib_flags)
+{
+	struct leaf_info *li;
+	struct hlist_head *hhead = &l->list;
+	struct hlist_node *node;
+	int ret;
+
+	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
+		if (l->key != (key & li->mask_plen))
+			continue;
+
+		ret = check_leaf_info(tb, t, li, flp, res, fib_flags);
+		if (ret <= 0)
+			return ret;
 	}
 
 	return 1;
@@ -1427,6 +1758,8 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	unsigned int current_prefix_length = KEYLENGTH;
 	struct tnode *cn;
 	t_key pref_mismatch;
+	struct fib_dir *dir;
+	struct leaf_info *li;
 
 	rcu_read_lock();
 
@@ -1438,6 +1771,25 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 	t->stats.gets++;
 #endif
 
+	dir = rcu_dereference(t->dir);
+	if (dir) {
+		/* no entry means no prefix covers the key at all */
+		li = fib_dir_lookup(dir, key);
+		if (!li)
+			goto failed;
+		ret = check_leaf_info(tb, t, li, flp, res, fib_flags);
+		if (ret <= 0) {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+			t->stats.dir_hit++;
+#endif
+			goto found;
+		}
+		/* longest prefix rejected the flow, backtrack in the trie */
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+		t->stats.dir_fallback++;
+#endif
+	}
+
 	/* Just a leaf? */
 	if (IS_LEAF(n)) {
 		ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
@@ -1642,6 +1994,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 	if (plen > 32)
 		return -EINVAL;
 
+	t->batching = cfg->fc_nlinfo.nl_net->ipv4.fib_batch;
 	key = ntohl(cfg->fc_dst);
 	mask = ntohl(inet_make_mask(plen));
 
@@ -1702,6 +2055,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	if (list_empty(fa_head)) {
 		hlist_del_rcu(&li->hlist);
+		fib_dir_remove(t, key, li);
 		free_leaf_info(li);
 	}
 
@@ -1713,7 +2067,9 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	fib_release_info(fa->fa_info);
 	alias_free_mem_rcu(fa);
-	if (ipv4_routing_changed) {
+	if (t->batching)
+		cfg->fc_nlinfo.nl_net->ipv4.fib_batch_changed = true;
+	else if (ipv4_routing_changed) {
 	    ipv4_routing_changed();
 	}
 	return 0;
@@ -1737,7 +2093,7 @@ static int trie_flush_list(struct list_head *head)
 	return found;
 }
 
-static int trie_flush_leaf(struct leaf *l)
+static int trie_flush_leaf(struct trie *t, struct leaf *l)
 {
 	int found = 0;
 	struct hlist_head *lih = &l->list;
@@ -1749,6 +2105,7 @@ static int trie_flush_leaf(struct leaf *l)
 
 		if (list_empty(&li->falh)) {
 			hlist_del_rcu(&li->hlist);
+			fib_dir_remove(t, l->key, li);
 			free_leaf_info(li);
 		}
 	}
@@ -1833,8 +2190,9 @@ int fib_table_flush(struct fib_table *tb)
 	struct leaf *l, *ll = NULL;
 	int found = 0;
 
+	t->batching = false;
 	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
-		found += trie_flush_leaf(l);
+		found += trie_flush_leaf(t, l);
 
 		if (ll && hlist_empty(&ll->list))
 			trie_leaf_remove(t, ll);
@@ -1848,8 +2206,32 @@ int fib_table_flush(struct fib_table *tb)
 	return found;
 }
 
+/*
+ * End of a route batch: do the rebalancing deferred by trie_rebalance().
+ * Caller must hold RTNL.
+ */
+void fib_table_commit(struct fib_table *tb)
+{
+	struct trie *t = (struct trie *) tb->tb_data;
+	struct rt_trie_node *n;
+
+	t->batching = false;
+	if (!t->rebalance_pending)
+		return;
+	t->rebalance_pending = false;
+
+	n = rtnl_dereference(t->trie);
+	if (!n || IS_LEAF(n) || !((struct tnode *)n)->dirty)
+		return;
+
+	n = trie_rebalance_subtree(t, (struct tnode *)n);
+	rcu_assign_pointer(t->trie, n);
+	tnode_free_flush();
+}
+
 void fib_free_table(struct fib_table *tb)
 {
+	fib_dir_destroy((struct trie *) tb->tb_data);
 	kfree(tb);
 }
 
@@ -1976,6 +2358,11 @@ void __init fib_trie_init(void)
 					   max(sizeof(struct leaf),
 					       sizeof(struct leaf_info)),
 					   0, SLAB_PANIC, NULL);
+
+	fib_dir_kmem = kmem_cache_create("ip_fib_dir",
+					 sizeof(struct fib_dir_chunk),
+					 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC,
+					 NULL);
 }
 
 
@@ -1995,6 +2382,7 @@ struct fib_table *fib_trie_table(u32 id)
 
 	t = (struct trie *) tb->tb_data;
 	memset(t, 0, sizeof(*t));
+	t->dir_threshold = FIB_DIR_MIN_PREFIXES;
 
 	return tb;
 }
@@ -2159,6 +2547,21 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 	seq_printf(seq, "Total size: %u  kB\n", (bytes + 1023) / 1024);
 }
 
+static void trie_show_dir(struct seq_file *seq, struct trie *t)
+{
+	struct fib_dir *dir;
+
+	rcu_read_lock();
+	dir = rcu_dereference(t->dir);
+	if (dir) {
+		seq_printf(seq, "\tDIR chunks:     %u\n", dir->chunks);
+		seq_printf(seq, "DIR size: %lu  kB\n",
+			   (unsigned long)(sizeof(struct fib_dir) + 1023 +
+			   dir->chunks * sizeof(struct fib_dir_chunk)) / 1024);
+	}
+	rcu_read_unlock();
+}
+
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 static void trie_show_usage(struct seq_file *seq,
 			    const struct trie_use_stats *stats)
@@ -2171,8 +2574,10 @@ static void trie_show_usage(struct seq_file *seq,
 	seq_printf(seq, "semantic match miss = %u\n",
 		   stats->semantic_match_miss);
 	seq_printf(seq, "null node hit= %u\n", stats->null_node_hit);
-	seq_printf(seq, "skipped node resize = %u\n\n",
+	seq_printf(seq, "skipped node resize = %u\n",
 		   stats->resize_node_skipped);
+	seq_printf(seq, "dir hit = %u\n", stats->dir_hit);
+	seq_printf(seq, "dir fallback = %u\n\n", stats->dir_fallback);
 }
 #endif /*  CONFIG_IP_FIB_TRIE_STATS */
 
@@ -2213,6 +2618,7 @@ static int fib_triestat_seq_show(struct seq_file *seq, void *v)
 
 			trie_collect_stats(t, &stat);
 			trie_show_stats(seq, &stat);
+			trie_show_dir(seq, t);
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 			trie_show_usage(seq, &t->stats);
 #endif
@@ -251,12 +251,9 @@ static inline bool icmpv4_xrlim_allow(struct net *net, struct rtable *rt,
 		goto out;
 
 	/* Limit if icmp type is enabled in ratemask. */
-	if ((1 << type) & net->ipv4.sysctl_icmp_ratemask) {
-		if (!rt->peer)
-			rt_bind_peer(rt, fl4->daddr, 1);
-		rc = inet_peer_xrlim_allow(rt->peer,
-					   net->ipv4.sysctl_icmp_ratelimit);
-	}
+	if ((1 << type) & net->ipv4.sysctl_icmp_ratemask)
+		rc = inet_xrlim_allow_v4(fl4->daddr,
+					 net->ipv4.sysctl_icmp_ratelimit);
 out:
 	return rc;
 }
@@ -1164,6 +1161,11 @@ static int __net_init icmp_sk_init(struct net *net)
 		 */
 		sock_set_flag(sk, SOCK_USE_WRITE_QUEUE);
 		inet_sk(sk)->pmtudisc = IP_PMTUDISC_DONT;
+		/*
+		 * Errors go to any source, spoofed ones included, so don't
+		 * bind an inet_peer per destination just for the IP ID.
+		 */
+		inet_sk(sk)->nopeer = 1;
 	}
 
 	/* Control parameters for ECHO replies. */
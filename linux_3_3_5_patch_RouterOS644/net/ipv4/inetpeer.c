@@ -18,6 +18,9 @@
 #include <linux/mm.h>
 #include <linux/net.h>
 #include <linux/workqueue.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
 #include <net/ip.h>
 #include <net/inetpeer.h>
 #include <net/secure_seq.h>
@@ -108,6 +111,41 @@ int inet_peer_threshold __read_mostly = 65536 + 128;	/* start to throw entries m
 int inet_peer_minttl __read_mostly = 120 * HZ;	/* TTL under high load: 120 sec */
 int inet_peer_maxttl __read_mostly = 10 * 60 * HZ;	/* usual time to live: 10 min */
 
+/*
+ * ICMP rate limiting state for addresses that have no other use for an
+ * inet_peer.  Binding a peer for every error sent made each spoofed
+ * source of a flood a node in the tree above.  Instead every CPU keeps a
+ * small set-associative table and recycles the least recently used way
+ * of a set on a miss, so a lookup is O(1) and the memory is fixed.  The
+ * table gets a set per MB of RAM, or xrlim_sets= sets (a power of two).
+ */
+#define XRLIM_CACHE_MIN_SETS	64
+#define XRLIM_CACHE_MAX_SETS	4096
+#define XRLIM_CACHE_WAYS	4
+
+struct xrlim_entry {
+	struct inetpeer_addr	daddr;
+	u32			rate_tokens;
+	unsigned long		rate_last;
+};
+
+struct xrlim_set {
+	struct xrlim_entry	way[XRLIM_CACHE_WAYS];
+};
+
+static DEFINE_PER_CPU(struct xrlim_set *, xrlim_cache);
+static unsigned int xrlim_sets __read_mostly;
+static u32 xrlim_rnd __read_mostly;
+
+static int __init set_xrlim_sets(char *str)
+{
+	if (!str)
+		return 0;
+	xrlim_sets = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("xrlim_sets=", set_xrlim_sets);
+
 static void inetpeer_gc_worker(struct work_struct *work)
 {
 	struct inet_peer *p, *n, *c;
@@ -159,6 +197,7 @@ static void inetpeer_gc_worker(struct work_struct *work)
 void __init inet_initpeers(void)
 {
 	struct sysinfo si;
+	int cpu;
 
 	/* Use the straight interface to information about memory. */
 	si_meminfo(&si);
@@ -179,6 +218,23 @@ void __init inet_initpeers(void)
 			NULL);
 
 	INIT_DELAYED_WORK_DEFERRABLE(&gc_work, inetpeer_gc_worker);
+
+	if (!xrlim_sets)
+		xrlim_sets = si.totalram >> (20 - PAGE_SHIFT);
+	xrlim_sets = clamp_t(unsigned int, xrlim_sets,
+			     XRLIM_CACHE_MIN_SETS, XRLIM_CACHE_MAX_SETS);
+	xrlim_sets = rounddown_pow_of_two(xrlim_sets);
+
+	get_random_bytes(&xrlim_rnd, sizeof(xrlim_rnd));
+	for_each_possible_cpu(cpu) {
+		struct xrlim_set *set;
+
+		set = kzalloc_node(xrlim_sets * sizeof(*set),
+				   GFP_KERNEL, cpu_to_node(cpu));
+		if (!set)
+			panic("cannot allocate inetpeer rate limit cache");
+		per_cpu(xrlim_cache, cpu) = set;
+	}
 }
 
 static int addr_compare(const struct inetpeer_addr *a,
@@ -543,30 +599,82 @@ EXPORT_SYMBOL_GPL(inet_putpeer);
  *
  * 	Shared between ICMPv4 and ICMPv6.
  */
-#define XRLIM_BURST_FACTOR 6
-bool inet_peer_xrlim_allow(struct inet_peer *peer, int timeout)
+static bool xrlim_take_token(u32 *tokens, unsigned long *last,
+			     int cost, int burst)
 {
 	unsigned long now, token;
 	bool rc = false;
 
-	if (!peer)
-		return true;
-
-	token = peer->rate_tokens;
+	token = *tokens;
 	now = jiffies;
-	token += now - peer->rate_last;
-	peer->rate_last = now;
-	if (token > XRLIM_BURST_FACTOR * timeout)
-		token = XRLIM_BURST_FACTOR * timeout;
-	if (token >= timeout) {
-		token -= timeout;
+	token += now - *last;
+	*last = now;
+	if (token > burst)
+		token = burst;
+	if (token >= cost) {
+		token -= cost;
 		rc = true;
 	}
-	peer->rate_tokens = token;
+	*tokens = token;
 	return rc;
 }
+
+bool inet_peer_xrlim_allow(struct inet_peer *peer, int timeout)
+{
+	if (!peer)
+		return true;
+
+	return xrlim_take_token(&peer->rate_tokens, &peer->rate_last,
+				timeout, XRLIM_BURST_FACTOR * timeout);
+}
 EXPORT_SYMBOL(inet_peer_xrlim_allow);
 
+/*
+ * Same token bucket as above, kept in the per-cpu cache instead of an
+ * inet_peer.  Limits are therefore per cpu.  An address new to the cache
+ * gets a single token rather than the full burst, so pushing it out of
+ * its set with newer ones doesn't buy a sender more errors.
+ */
+bool inet_xrlim_allow(const struct inetpeer_addr *daddr, int cost, int burst)
+{
+	struct xrlim_entry *e, *victim;
+	struct xrlim_set *set;
+	u32 hash;
+	bool rc;
+	int i;
+
+	if (daddr->family == AF_INET)
+		hash = jhash_1word((__force u32)daddr->addr.a4, xrlim_rnd);
+	else
+		hash = jhash2((__force u32 *)daddr->addr.a6, 4, xrlim_rnd);
+
+	local_bh_disable();
+	set = __this_cpu_read(xrlim_cache) + (hash & (xrlim_sets - 1));
+	victim = &set->way[0];
+	for (i = 0; i < XRLIM_CACHE_WAYS; i++) {
+		e = &set->way[i];
+		/* ways fill in order and are never emptied */
+		if (!e->daddr.family) {
+			victim = e;
+			break;
+		}
+		if (e->daddr.family == daddr->family &&
+		    addr_compare(daddr, &e->daddr) == 0)
+			goto found;
+		if (time_before(e->rate_last, victim->rate_last))
+			victim = e;
+	}
+	e = victim;
+	e->daddr = *daddr;
+	e->rate_tokens = cost;
+	e->rate_last = jiffies;
+found:
+	rc = xrlim_take_token(&e->rate_tokens, &e->rate_last, cost, burst);
+	local_bh_enable();
+	return rc;
+}
+EXPORT_SYMBOL(inet_xrlim_allow);
+
 static void inetpeer_inval_rcu(struct rcu_head *head)
 {
 	struct inet_peer *p = container_of(head, struct inet_peer, gc_rcu);
@@ -131,6 +131,7 @@ static int ip_rt_gc_elasticity __read_mostly	= 8;
 static int ip_rt_mtu_expires __read_mostly	= 10 * 60 * HZ;
 static int ip_rt_min_pmtu __read_mostly		= 512 + 20 + 20;
 static int ip_rt_min_advmss __read_mostly	= 256;
+static int ip_rt_cacheless_forwarding __read_mostly;
 static int rt_chain_length_max __read_mostly	= 20;
 
 static struct delayed_work expires_work;
@@ -1148,6 +1149,30 @@ static int rt_bind_neighbour(struct rtable *rt)
 	return 0;
 }
 
+/*
+ * Hand a route to the caller without hashing it.  The caller holds the
+ * sole reference; DST_NOCACHE lets dst_release() free it right away.
+ */
+static struct rtable *rt_attach_uncached(struct rtable *rt,
+					 struct sk_buff *skb)
+{
+	rt->dst.flags |= DST_NOCACHE;
+	if (rt->rt_type == RTN_UNICAST || rt_is_output_route(rt)) {
+		int err = rt_bind_neighbour(rt);
+		if (err) {
+			if (net_ratelimit())
+				printk(KERN_WARNING
+				    "Neighbour table failure & not caching routes.\n");
+			ip_rt_put(rt);
+			return ERR_PTR(err);
+		}
+	}
+
+	if (skb)
+		skb_dst_set(skb, &rt->dst);
+	return rt;
+}
+
 static struct rtable *rt_intern_hash(unsigned hash, struct rtable *rt,
 				     struct sk_buff *skb, int ifindex)
 {
@@ -1183,20 +1208,7 @@ restart:
                  *
                  * Also this allows real parents like xfrm_dst to free it.
 		 */
-
-		rt->dst.flags |= DST_NOCACHE;
-		if (rt->rt_type == RTN_UNICAST || rt_is_output_route(rt)) {
-			int err = rt_bind_neighbour(rt);
-			if (err) {
-				if (net_ratelimit())
-					printk(KERN_WARNING
-					    "Neighbour table failure & not caching routes.\n");
-				ip_rt_put(rt);
-				return ERR_PTR(err);
-			}
-		}
-
-		goto skip_hashing;
+		return rt_attach_uncached(rt, skb);
 	}
 
 	rthp = &rt_hash_table[hash].chain;
@@ -1329,7 +1341,6 @@ restart:
 
 	spin_unlock_bh(rt_hash_lock_addr(hash));
 
-skip_hashing:
 	if (skb)
 		skb_dst_set(skb, &rt->dst);
 	return rt;
@@ -1641,9 +1652,7 @@ void ip_rt_send_redirect(struct sk_buff *skb)
 static int ip_error(struct sk_buff *skb)
 {
 	struct rtable *rt = skb_rtable(skb);
-	struct inet_peer *peer;
-	unsigned long now;
-	bool send;
+	struct inetpeer_addr daddr;
 	int code;
 
 	switch (rt->dst.error) {
@@ -1663,23 +1672,9 @@ static int ip_error(struct sk_buff *skb)
 		break;
 	}
 
-	if (!rt->peer)
-		rt_bind_peer(rt, rt->rt_dst, 1);
-	peer = rt->peer;
-
-	send = true;
-	if (peer) {
-		now = jiffies;
-		peer->rate_tokens += now - peer->rate_last;
-		if (peer->rate_tokens > ip_rt_error_burst)
-			peer->rate_tokens = ip_rt_error_burst;
-		peer->rate_last = now;
-		if (peer->rate_tokens >= ip_rt_error_cost)
-			peer->rate_tokens -= ip_rt_error_cost;
-		else
-			send = false;
-	}
-	if (send)
+	daddr.addr.a4 = rt->rt_dst;
+	daddr.family = AF_INET;
+	if (inet_xrlim_allow(&daddr, ip_rt_error_cost, ip_rt_error_burst))
 		icmp_send(skb, ICMP_DEST_UNREACH, code, 0);
 
 out:	kfree_skb(skb);
@@ -2146,13 +2141,109 @@ static void ip_handle_martian_source(struct net_device *dev,
 #endif
 }
 
+/*
+ * Cacheless forwarding: a route via a gateway does not depend on the
+ * addresses of the packet, so instead of hashing one dst per flow we
+ * keep one per (nexthop, input device) and let every flow share it.
+ */
+static struct rtable __rcu **rt_nh_input_slot(const struct fib_result *res,
+					      int iif)
+{
+	struct fib_nh *nh = &FIB_RES_NH(*res);
+	struct rtable __rcu **slot, **alt;
+	struct rtable *rt;
+	unsigned int i;
+
+	if (!ip_rt_cacheless_forwarding || res->type != RTN_UNICAST ||
+	    !nh->nh_gw || nh->nh_scope != RT_SCOPE_LINK || nh->nh_mplskey)
+		return NULL;
+
+	/* Two candidate slots per device, so two input devices hashing
+	 * to the same slot don't keep evicting each other. */
+	i = jhash_1word(iif, 0) & (FIB_NH_RTH_SLOTS - 1);
+	slot = &nh->nh_rth_input[i];
+	alt = &nh->nh_rth_input[i ^ 1];
+
+	rt = rcu_dereference(*slot);
+	if (!rt || rt->rt_route_iif == iif)
+		return slot;
+	rt = rcu_dereference(*alt);
+	if (!rt || rt->rt_route_iif == iif || rt_is_expired(rt))
+		return alt;
+	return slot;
+}
+
+static inline bool rt_nh_input_valid(struct rtable *rt, int iif,
+				     __be32 spec_dst,
+				     const struct sk_buff *skb)
+{
+	return rt->rt_route_iif == iif &&
+	       rt->rt_spec_dst == spec_dst &&
+	       rt->rt_mark == skb->prmark &&
+	       !rt->peer && !rt->dst.obsolete && !rt_is_expired(rt);
+}
+
+/* Only routes carrying nothing specific to the first packet are shared. */
+static inline bool rt_nh_input_shareable(const struct rtable *rt)
+{
+#ifdef CONFIG_IP_ROUTE_CLASSID
+	if (rt->dst.tclassid)
+		return false;
+#endif
+	return !rt->rt_flags && !rt->peer;
+}
+
+static int rt_nh_cache_input(struct rtable __rcu **slot, struct rtable *rt,
+			     const struct fib_info *fi, struct sk_buff *skb)
+{
+	struct rtable *orig, *prev;
+	int err;
+
+	err = rt_bind_neighbour(rt);
+	if (err) {
+		rt->dst.flags |= DST_NOCACHE;
+		ip_rt_put(rt);
+		return err;
+	}
+	skb_dst_set(skb, &rt->dst);
+
+	orig = rcu_dereference(*slot);
+	prev = cmpxchg(slot, orig, rt);
+	if (prev != orig) {
+		/* lost the race, this one is used just once */
+		rt->dst.flags |= DST_NOCACHE;
+		return 0;
+	}
+	if (orig)
+		rt_free(orig);
+
+	/* cmpxchg() orders us against fib_release_info() */
+	if (fi->fib_dead && cmpxchg(slot, rt, NULL) == rt)
+		rt_free(rt);
+	return 0;
+}
+
+void rt_nh_flush_input(struct fib_nh *nh)
+{
+	struct rtable *rt;
+	int i;
+
+	for (i = 0; i < FIB_NH_RTH_SLOTS; i++) {
+		rt = xchg(&nh->nh_rth_input[i], NULL);
+		if (rt)
+			rt_free(rt);
+	}
+}
+EXPORT_SYMBOL(rt_nh_flush_input);
+
 /* called in rcu_read_lock() section */
 static int __mkroute_input(struct sk_buff *skb,
 			   const struct fib_result *res,
 			   struct in_device *in_dev,
 			   __be32 daddr, __be32 saddr, u32 tos,
-			   struct rtable **result)
+			   bool noref, struct rtable **result)
 {
+	struct rtable __rcu **slot;
 	struct rtable *rth;
 	int err;
 	struct in_device *out_dev;
@@ -2202,6 +2293,25 @@ static int __mkroute_input(struct sk_buff *skb,
 		}
 	}
 
+	slot = NULL;
+	if (!flags && !itag)
+		slot = rt_nh_input_slot(res, in_dev->dev->ifindex);
+	if (slot) {
+		rth = rcu_dereference(*slot);
+		if (rth && rt_nh_input_valid(rth, in_dev->dev->ifindex,
+					     spec_dst, skb)) {
+			if (noref) {
+				skb_dst_set_noref(skb, &rth->dst);
+			} else {
+				dst_hold(&rth->dst);
+				skb_dst_set(skb, &rth->dst);
+			}
+			RT_CACHE_STAT_INC(in_hit);
+			*result = NULL;
+			return 0;
+		}
+	}
+
 	rth = rt_dst_alloc(out_dev->dev,
 			   IN_DEV_CONF_GET(in_dev, NOPOLICY),
 			   IN_DEV_CONF_GET(out_dev, NOXFRM));
@@ -2233,6 +2343,11 @@ static int __mkroute_input(struct sk_buff *skb,
 
 	rt_set_nexthop(rth, NULL, res, res->fi, res->type, itag);
 
+	if (slot && rt_nh_input_shareable(rth)) {
+		*result = NULL;
+		return rt_nh_cache_input(slot, rth, res->fi, skb);
+	}
+
 	*result = rth;
 	err = 0;
  cleanup:
@@ -2243,7 +2358,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
 			    struct fib_result *res,
 			    const struct flowi4 *fl4,
 			    struct in_device *in_dev,
-			    __be32 daddr, __be32 saddr, u32 tos)
+			    __be32 daddr, __be32 saddr, u32 tos, bool noref)
 {
 	struct rtable* rth = NULL;
 	int err;
@@ -2255,14 +2370,19 @@ static int ip_mkroute_input(struct sk_buff *skb,
 #endif
 
 	/* create a routing cache entry */
-	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
-	if (err)
+	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, noref,
+			      &rth);
+	if (err || !rth)
 		return err;
 
-	/* put it into the cache */
-	hash = rt_hash(daddr, saddr, fl4->flowi4_iif,
-		       rt_genid(dev_net(rth->dst.dev)));
-	rth = rt_intern_hash(hash, rth, skb, fl4->flowi4_iif);
+	if (ip_rt_cacheless_forwarding) {
+		rth = rt_attach_uncached(rth, skb);
+	} else {
+		/* put it into the cache */
+		hash = rt_hash(daddr, saddr, fl4->flowi4_iif,
+			       rt_genid(dev_net(rth->dst.dev)));
+		rth = rt_intern_hash(hash, rth, skb, fl4->flowi4_iif);
+	}
 	if (IS_ERR(rth))
 		return PTR_ERR(rth);
 	return 0;
@@ -2280,7 +2400,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
  */
 
 static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
-			       u8 tos, struct net_device *dev)
+			       u8 tos, struct net_device *dev, bool noref)
 {
 	struct fib_result res;
 	struct in_device *in_dev = __in_dev_get_rcu(dev);
@@ -2357,7 +2477,8 @@ static int ip_route_input_slow(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 	if (res.type != RTN_UNICAST)
 		goto martian_destination;
 
-	err = ip_mkroute_input(skb, &res, &fl4, in_dev, daddr, saddr, tos);
+	err = ip_mkroute_input(skb, &res, &fl4, in_dev, daddr, saddr, tos,
+			       noref);
 out:	return err;
 
 brd_input:
@@ -2415,8 +2536,12 @@ local_input:
 		rth->dst.error= -err;
 		rth->rt_flags 	&= ~RTCF_LOCAL;
 	}
-	hash = rt_hash(daddr, saddr, fl4.flowi4_iif, rt_genid(net));
-	rth = rt_intern_hash(hash, rth, skb, fl4.flowi4_iif);
+	if (ip_rt_cacheless_forwarding) {
+		rth = rt_attach_uncached(rth, skb);
+	} else {
+		hash = rt_hash(daddr, saddr, fl4.flowi4_iif, rt_genid(net));
+		rth = rt_intern_hash(hash, rth, skb, fl4.flowi4_iif);
+	}
 	err = 0;
 	if (IS_ERR(rth))
 		err = PTR_ERR(rth);
@@ -2477,7 +2602,7 @@ int ip_route_input_common(struct sk_buff *skb, __be32 daddr, __be32 saddr,
 
 	rcu_read_lock();
 
-	if (!rt_caching(net))
+	if (!rt_caching(net) || ip_rt_cacheless_forwarding)
 		goto skip_cache;
 
 	tos &= IPTOS_RT_MASK;
@@ -2541,7 +2666,7 @@ skip_cache:
 		rcu_read_unlock();
 		return -EINVAL;
 	}
-	res = ip_route_input_slow(skb, daddr, saddr, tos, dev);
+	res = ip_route_input_slow(skb, daddr, saddr, tos, dev, noref);
 	rcu_read_unlock();
 	return res;
 }
@@ -2985,7 +3110,7 @@ struct rtable *ip_route_output_flow(struct net *net, struct flowi4 *flp4,
 }
 EXPORT_SYMBOL_GPL(ip_route_output_flow);
 
-static int rt_fill_info(struct net *net,
+static int rt_fill_info(struct net *net, __be32 dst, __be32 src, u8 tos,
 			struct sk_buff *skb, u32 pid, u32 seq, int event,
 			int nowait, unsigned int flags)
 {
@@ -3004,7 +3129,7 @@ static int rt_fill_info(struct net *net,
 	r->rtm_family	 = AF_INET;
 	r->rtm_dst_len	= 32;
 	r->rtm_src_len	= 0;
-	r->rtm_tos	= rt->rt_key_tos;
+	r->rtm_tos	= tos;
 	r->rtm_table	= RT_TABLE_MAIN;
 	NLA_PUT_U32(skb, RTA_TABLE, RT_TABLE_MAIN);
 	r->rtm_type	= rt->rt_type;
@@ -3014,11 +3139,11 @@ static int rt_fill_info(struct net *net,
 	if (rt->rt_flags & RTCF_NOTIFY)
 		r->rtm_flags |= RTM_F_NOTIFY;
 
-	NLA_PUT_BE32(skb, RTA_DST, rt->rt_dst);
+	NLA_PUT_BE32(skb, RTA_DST, dst);
 
-	if (rt->rt_key_src) {
+	if (src) {
 		r->rtm_src_len = 32;
-		NLA_PUT_BE32(skb, RTA_SRC, rt->rt_key_src);
+		NLA_PUT_BE32(skb, RTA_SRC, src);
 	}
 	if (rt->dst.dev)
 		NLA_PUT_U32(skb, RTA_OIF, rt->dst.dev->ifindex);
@@ -3028,10 +3153,10 @@ static int rt_fill_info(struct net *net,
 #endif
 	if (rt_is_input_route(rt))
 		NLA_PUT_BE32(skb, RTA_PREFSRC, rt->rt_spec_dst);
-	else if (rt->rt_src != rt->rt_key_src)
+	else if (rt->rt_src != src)
 		NLA_PUT_BE32(skb, RTA_PREFSRC, rt->rt_src);
 
-	if (rt->rt_dst != rt->rt_gateway)
+	if (dst != rt->rt_gateway)
 		NLA_PUT_BE32(skb, RTA_GATEWAY, rt->rt_gateway);
 
 	if (rtnetlink_put_metrics(skb, dst_metrics_ptr(&rt->dst)) < 0)
@@ -3059,12 +3184,9 @@ static int rt_fill_info(struct net *net,
 
 	if (rt_is_input_route(rt)) {
 #ifdef CONFIG_IP_MROUTE
-		__be32 dst = rt->rt_dst;
-
 		if (ipv4_is_multicast(dst) && !ipv4_is_local_multicast(dst) &&
 		    IPV4_DEVCONF_ALL(net, MC_FORWARDING)) {
-			int err = ipmr_get_route(net, skb,
-						 rt->rt_src, rt->rt_dst,
+			int err = ipmr_get_route(net, skb, src, dst,
 						 r, nowait);
 			if (err <= 0) {
 				if (!nowait) {
@@ -3174,8 +3296,17 @@ static int inet_rtm_getroute(struct sk_buff *in_skb, struct nlmsghdr* nlh, void
 	if (rtm->rtm_flags & RTM_F_NOTIFY)
 		rt->rt_flags |= RTCF_NOTIFY;
 
-	err = rt_fill_info(net, skb, NETLINK_CB(in_skb).pid, nlh->nlmsg_seq,
-			   RTM_NEWROUTE, 0, 0);
+	/* an input route may be shared by all flows to its nexthop, so
+	 * report the addresses asked for rather than its creator's */
+	if (iif)
+		err = rt_fill_info(net, dst, src, rtm->rtm_tos, skb,
+				   NETLINK_CB(in_skb).pid, nlh->nlmsg_seq,
+				   RTM_NEWROUTE, 0, 0);
+	else
+		err = rt_fill_info(net, rt->rt_dst, rt->rt_key_src,
+				   rt->rt_key_tos, skb,
+				   NETLINK_CB(in_skb).pid, nlh->nlmsg_seq,
+				   RTM_NEWROUTE, 0, 0);
 	if (err <= 0)
 		goto errout_free;
 
@@ -3212,7 +3343,9 @@ int ip_rt_dump(struct sk_buff *skb,  struct netlink_callback *cb)
 			if (rt_is_expired(rt))
 				continue;
 			skb_dst_set_noref(skb, &rt->dst);
-			if (rt_fill_info(net, skb, NETLINK_CB(cb->skb).pid,
+			if (rt_fill_info(net, rt->rt_dst, rt->rt_key_src,
+					 rt->rt_key_tos, skb,
+					 NETLINK_CB(cb->skb).pid,
 					 cb->nlh->nlmsg_seq, RTM_NEWROUTE,
 					 1, NLM_F_MULTI) <= 0) {
 				skb_dst_drop(skb);
@@ -3365,6 +3498,13 @@ static ctl_table ipv4_route_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "cacheless_forwarding",
+		.data		= &ip_rt_cacheless_forwarding,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec,
+	},
 	{ }
 };
 
@@ -55,6 +55,7 @@
 #include <net/xfrm.h>
 #include <net/checksum.h>
 #include <linux/mroute6.h>
+#include <linux/fp_counters.h>
 
 int ip6_fragment(struct sk_buff *skb, int (*output)(struct sk_buff *));
 
@@ -540,6 +541,83 @@ drop:
 	return -EINVAL;
 }
 
+/*
+ *	Forward a packet of a fasttracked connection straight to the
+ *	neighbour, without FORWARD and POST_ROUTING hooks. Anything that
+ *	needs more than plain forwarding (icmp errors, redirects, IPsec,
+ *	hop-by-hop options, fragmentation) is left to ip6_forward, then
+ *	false is returned and the skb is untouched apart from its route.
+ */
+bool ip6_fast_forward(struct sk_buff *skb)
+{
+	struct dst_entry *dst;
+	struct ipv6hdr *hdr = ipv6_hdr(skb);
+	struct net *net = dev_net(skb->dev);
+	struct inet6_dev *idev;
+	int addrtype;
+	u32 mtu;
+
+	if (net->ipv6.devconf_all->forwarding == 0 ||
+	    net->ipv6.devconf_all->proxy_ndp)
+		return false;
+
+	if (skb->pkt_type != PACKET_HOST || skb_sec_path(skb))
+		return false;
+
+	if (hdr->nexthdr == NEXTHDR_HOP || hdr->hop_limit <= 1)
+		return false;
+
+#ifdef CONFIG_XFRM
+	if (net->xfrm.policy_count[XFRM_POLICY_FWD] ||
+	    net->xfrm.policy_count[XFRM_POLICY_OUT])
+		return false;
+#endif
+
+	addrtype = ipv6_addr_type(&hdr->saddr);
+	if (addrtype == IPV6_ADDR_ANY ||
+	    addrtype & (IPV6_ADDR_MULTICAST | IPV6_ADDR_LOOPBACK |
+			IPV6_ADDR_LINKLOCAL))
+		return false;
+
+	if (!skb_dst(skb))
+		ip6_route_input(skb);
+	dst = skb_dst(skb);
+
+	/* local, multicast, unreachable and redirect candidates */
+	if (dst->input != ip6_forward || dst->dev == skb->dev || dst->error)
+		return false;
+
+	idev = ip6_dst_idev(dst);
+	if (unlikely(!idev || idev->cnf.disable_ipv6))
+		return false;
+
+	mtu = dst_mtu(dst);
+	if (mtu < IPV6_MIN_MTU)
+		mtu = IPV6_MIN_MTU;
+	if ((skb->len > mtu && !skb_is_gso(skb)) || dst_allfrag(dst))
+		return false;
+
+	if (skb_warn_if_lro(skb))
+		return false;
+
+	if (skb_cow(skb, dst->dev->hard_header_len)) {
+		IP6_INC_STATS_BH(net, idev, IPSTATS_MIB_OUTDISCARDS);
+		kfree_skb(skb);
+		return true;
+	}
+
+	skb_forward_csum(skb);
+	hdr = ipv6_hdr(skb);
+	hdr->hop_limit--;
+
+	IP6_INC_STATS_BH(net, idev, IPSTATS_MIB_OUTFORWDATAGRAMS);
+	fp_counter_add(skb->dev->fp.rx_counter, skb->len);
+	fp_counter_add(dst->dev->fp.tx_counter, skb->len);
+	ip6_finish_output2(skb);
+	return true;
+}
+EXPORT_SYMBOL(ip6_fast_forward);
+
 static void ip6_copy_metadata(struct sk_buff *to, struct sk_buff *from)
 {
 	to->pkt_type = from->pkt_type;
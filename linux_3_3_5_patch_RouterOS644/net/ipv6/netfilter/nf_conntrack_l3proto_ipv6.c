@@ -26,6 +26,7 @@
 #include <net/netfilter/nf_conntrack_l4proto.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
 #include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_acct.h>
 #include <net/netfilter/nf_conntrack_zones.h>
 #include <net/netfilter/ipv6/nf_conntrack_ipv6.h>
 #include <net/netfilter/ipv6/nf_defrag_ipv6.h>
@@ -239,6 +240,84 @@ static unsigned int ipv6_conntrack_local(unsigned int hooknum,
 	return __ipv6_conntrack_in(dev_net(out), hooknum, skb, okfn);
 }
 
+/* per cpu slot for the direction, taken by the first fasttracked packet;
+ * without one the atomic fp counters are used
+ */
+static u32 ipv6_fasttrack_slot(struct nf_conn_counter *acct)
+{
+	u32 slot = ACCESS_ONCE(acct->fp_counter);
+
+	if (likely(slot))
+		return slot;
+
+	slot = fp_counter_alloc();
+	if (slot && cmpxchg(&acct->fp_counter, 0, slot) != 0) {
+		fp_counter_free(slot);
+		slot = ACCESS_ONCE(acct->fp_counter);
+	}
+	return slot;
+}
+
+/* Established connections marked by FASTPATHCONN skip FORWARD and
+ * POST_ROUTING.  This runs last in PRE_ROUTING so that the route lookup
+ * sees the mark set by mangle, as ip6_rcv_finish() would.
+ */
+static unsigned int ipv6_fasttrack(unsigned int hooknum,
+				   struct sk_buff *skb,
+				   const struct net_device *in,
+				   const struct net_device *out,
+				   int (*okfn)(struct sk_buff *))
+{
+	struct nf_conn *ct;
+	struct nf_conn_counter *acct;
+	enum ip_conntrack_info ctinfo;
+	unsigned int len;
+	u32 slot;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct || !(ct->status & IPS_FASTPATH))
+		return NF_ACCEPT;
+
+	if (ctinfo != IP_CT_ESTABLISHED && ctinfo != IP_CT_ESTABLISHED_REPLY)
+		return NF_ACCEPT;
+
+	/* helpers and fragments need ipv6_confirm */
+	if (nf_ct_is_untracked(ct) || nfct_help(ct) || skb->nfct_reasm)
+		return NF_ACCEPT;
+
+#ifdef CONFIG_BRIDGE_NETFILTER
+	/* bridged, the bridge forwards it */
+	if (skb->nf_bridge)
+		return NF_ACCEPT;
+#endif
+
+	/* ct may be gone once the skb is sent, account up front */
+	len = skb->len;
+	slot = 0;
+	acct = nf_conn_acct_find(ct);
+	if (acct) {
+		acct += CTINFO2DIR(ctinfo);
+		slot = ipv6_fasttrack_slot(acct);
+		if (slot) {
+			fp_counter_add(slot, len);
+		} else {
+			atomic64_inc(&acct->fp_packets);
+			atomic64_add(len, &acct->fp_bytes);
+		}
+	}
+
+	if (ip6_fast_forward(skb))
+		return NF_STOLEN;
+
+	if (slot) {
+		fp_counter_sub(slot, len);
+	} else if (acct) {
+		atomic64_dec(&acct->fp_packets);
+		atomic64_sub(len, &acct->fp_bytes);
+	}
+	return NF_ACCEPT;
+}
+
 static struct nf_hook_ops ipv6_conntrack_ops[] __read_mostly = {
 	{
 		.hook		= ipv6_conntrack_in,
@@ -247,6 +326,13 @@ static struct nf_hook_ops ipv6_conntrack_ops[] __read_mostly = {
 		.hooknum	= NF_INET_PRE_ROUTING,
 		.priority	= NF_IP6_PRI_CONNTRACK,
 	},
+	{
+		.hook		= ipv6_fasttrack,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV6,
+		.hooknum	= NF_INET_PRE_ROUTING,
+		.priority	= NF_IP6_PRI_LAST,
+	},
 	{
 		.hook		= ipv6_conntrack_local,
 		.owner		= THIS_MODULE,
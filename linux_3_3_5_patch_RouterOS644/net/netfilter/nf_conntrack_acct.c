@@ -51,9 +51,20 @@ seq_print_acct(struct seq_file *s, const struct nf_conn *ct, int dir)
 };
 EXPORT_SYMBOL_GPL(seq_print_acct);
 
+static void nf_ct_acct_destroy(struct nf_conn *ct)
+{
+	struct nf_conn_counter *acct = nf_conn_acct_find(ct);
+
+	if (!acct)
+		return;
+	fp_counter_free(acct[IP_CT_DIR_ORIGINAL].fp_counter);
+	fp_counter_free(acct[IP_CT_DIR_REPLY].fp_counter);
+}
+
 static struct nf_ct_ext_type acct_extend __read_mostly = {
 	.len	= sizeof(struct nf_conn_counter[IP_CT_DIR_MAX]),
 	.align	= __alignof__(struct nf_conn_counter[IP_CT_DIR_MAX]),
+	.destroy = nf_ct_acct_destroy,
 	.id	= NF_CT_EXT_ACCT,
 };
 
@@ -44,6 +44,8 @@
 #include <net/netfilter/nf_conntrack_ecache.h>
 #include <net/netfilter/nf_conntrack_zones.h>
 #include <net/netfilter/nf_conntrack_timestamp.h>
+#include <net/netfilter/nf_conntrack_connlimit.h>
+#include <net/netfilter/nf_conntrack_pcc.h>
 #include <net/netfilter/nf_nat.h>
 #include <net/netfilter/nf_nat_core.h>
 
@@ -57,6 +59,99 @@ EXPORT_SYMBOL_GPL(nfnetlink_parse_nat_setup_hook);
 DEFINE_SPINLOCK(nf_conntrack_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
+/*
+ * The hash is guarded by nf_conntrack_locks[], picked by bucket, while
+ * nf_conntrack_lock is left with the expectations and helpers.  Lock
+ * order is nf_conntrack_lock, then bucket locks, then the per-cpu list
+ * lock.  Whoever moves entries across the whole table (resize, change
+ * of a NATed address) stops all bucket lockers with
+ * nf_conntrack_all_lock(); inserts also recheck nf_conntrack_generation
+ * as the table may have been resized while they computed their hashes.
+ */
+spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS] __cacheline_aligned_in_smp;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks);
+
+static DEFINE_SPINLOCK(nf_conntrack_locks_all_lock);
+static bool nf_conntrack_locks_all;
+static seqcount_t nf_conntrack_generation = SEQCNT_ZERO;
+
+/* BHs must be disabled */
+void nf_conntrack_lock_bucket(unsigned int bucket)
+{
+	spinlock_t *lock = &nf_conntrack_locks[bucket % CONNTRACK_LOCKS];
+
+	spin_lock(lock);
+	while (unlikely(ACCESS_ONCE(nf_conntrack_locks_all))) {
+		spin_unlock(lock);
+		/* wait for nf_conntrack_all_unlock() */
+		spin_lock(&nf_conntrack_locks_all_lock);
+		spin_unlock(&nf_conntrack_locks_all_lock);
+		spin_lock(lock);
+	}
+	/* pairs with the smp_wmb() in nf_conntrack_all_unlock() */
+	smp_rmb();
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_lock_bucket);
+
+void nf_conntrack_unlock_bucket(unsigned int bucket)
+{
+	spin_unlock(&nf_conntrack_locks[bucket % CONNTRACK_LOCKS]);
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_unlock_bucket);
+
+static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
+{
+	h1 %= CONNTRACK_LOCKS;
+	h2 %= CONNTRACK_LOCKS;
+	spin_unlock(&nf_conntrack_locks[h1]);
+	if (h1 != h2)
+		spin_unlock(&nf_conntrack_locks[h2]);
+}
+
+/* Returns true, with nothing locked, if the hash was resized meanwhile */
+static bool nf_conntrack_double_lock(unsigned int h1, unsigned int h2,
+				     unsigned int sequence)
+{
+	h1 %= CONNTRACK_LOCKS;
+	h2 %= CONNTRACK_LOCKS;
+	if (h1 <= h2) {
+		nf_conntrack_lock_bucket(h1);
+		if (h1 != h2)
+			spin_lock_nested(&nf_conntrack_locks[h2],
+					 SINGLE_DEPTH_NESTING);
+	} else {
+		nf_conntrack_lock_bucket(h2);
+		spin_lock_nested(&nf_conntrack_locks[h1],
+				 SINGLE_DEPTH_NESTING);
+	}
+	if (read_seqcount_retry(&nf_conntrack_generation, sequence)) {
+		nf_conntrack_double_unlock(h1, h2);
+		return true;
+	}
+	return false;
+}
+
+/* BHs must be disabled */
+static void nf_conntrack_all_lock(void)
+{
+	int i;
+
+	spin_lock(&nf_conntrack_locks_all_lock);
+	nf_conntrack_locks_all = true;
+	/* wait out the current holders, new ones see the flag and back off */
+	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+		spin_lock(&nf_conntrack_locks[i]);
+		spin_unlock(&nf_conntrack_locks[i]);
+	}
+}
+
+static void nf_conntrack_all_unlock(void)
+{
+	smp_wmb();
+	nf_conntrack_locks_all = false;
+	spin_unlock(&nf_conntrack_locks_all_lock);
+}
+
 unsigned int nf_conntrack_htable_size __read_mostly;
 EXPORT_SYMBOL_GPL(nf_conntrack_htable_size);
 
@@ -175,19 +270,57 @@ nf_ct_invert_tuple(struct nf_conntrack_tuple *inverse,
 }
 EXPORT_SYMBOL_GPL(nf_ct_invert_tuple);
 
+/* must be called with the bucket locks held */
 static void
 clean_from_lists(struct nf_conn *ct)
 {
 	pr_debug("clean_from_lists(%p)\n", ct);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode);
+}
 
-	/* Destroy all pending expectations */
-	nf_ct_remove_expectations(ct);
+/*
+ * The unconfirmed and dying lists are per cpu, a conntrack stays on the
+ * list of the cpu it was added on.  BHs must be disabled.
+ */
+static void nf_ct_add_to_dying_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+			     &pcpu->dying);
+	spin_unlock(&pcpu->lock);
 }
 
-void (*connlimit_destroy_conntrack)(struct nf_conn *);
-EXPORT_SYMBOL(connlimit_destroy_conntrack);
+static void nf_ct_add_to_unconfirmed_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+				 &pcpu->unconfirmed);
+	spin_unlock(&pcpu->lock);
+}
+
+static void nf_ct_del_from_dying_or_unconfirmed_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	/* We overload first tuple to link into unconfirmed or dying list.*/
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
+	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	spin_unlock(&pcpu->lock);
+}
 
 static void
 destroy_conntrack(struct nf_conntrack *nfct)
@@ -196,12 +329,8 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	struct net *net = nf_ct_net(ct);
 	struct nf_conntrack_l4proto *l4proto;
 
-	if (connlimit_destroy_conntrack) {
-	    connlimit_destroy_conntrack(ct);
-	}
 	pr_debug("destroy_conntrack(%p)\n", ct);
 	NF_CT_ASSERT(atomic_read(&nfct->use) == 0);
-	NF_CT_ASSERT(!timer_pending(&ct->timeout));
 
 	/* To make sure we don't get any weird locking issues here:
 	 * destroy_conntrack() MUST NOT be called with a write lock
@@ -213,21 +342,22 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	rcu_read_unlock();
 
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Expectations will have been removed in clean_from_lists,
+	/* Expectations will have been removed in nf_ct_delete_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
-	 * too. */
-	nf_ct_remove_expectations(ct);
+	 * too.  Only helped conntracks can have any. */
+	if (nfct_help(ct)) {
+		spin_lock_bh(&nf_conntrack_lock);
+		nf_ct_remove_expectations(ct);
+		spin_unlock_bh(&nf_conntrack_lock);
+	}
 
 	if(ct->layer7.data) kfree(ct->layer7.data);
 
-	/* We overload first tuple to link into unconfirmed or dying list.*/
-		BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
-		hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-
+	local_bh_disable();
+	nf_ct_del_from_dying_or_unconfirmed_list(ct);
 	NF_CT_STAT_INC(net, delete);
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 
 	if (ct->master)
 		nf_ct_put(ct->master);
@@ -239,69 +369,80 @@ destroy_conntrack(struct nf_conntrack *nfct)
 void nf_ct_delete_from_lists(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
+	unsigned int hash, repl_hash, sequence;
+	u16 zone = nf_ct_zone(ct);
 
 	nf_ct_helper_destroy(ct);
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Inside lock so preempt is disabled on module removal path.
+
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		hash = hash_conntrack(net, zone,
+				      &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		repl_hash = hash_conntrack(net, zone,
+					   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (nf_conntrack_double_lock(hash, repl_hash, sequence));
+
+	/* BHs are off so preempt is disabled on module removal path.
 	 * Otherwise we can get spurious warnings. */
 	NF_CT_STAT_INC(net, delete_list);
 	clean_from_lists(ct);
-	/* add this conntrack to the dying list */
-	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			     &net->ct.dying);
-	spin_unlock_bh(&nf_conntrack_lock);
-}
-EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
+	nf_conntrack_double_unlock(hash, repl_hash);
 
-static void death_by_event(unsigned long ul_conntrack)
-{
-	struct nf_conn *ct = (void *)ul_conntrack;
-	struct net *net = nf_ct_net(ct);
-
-	if (nf_conntrack_event(IPCT_DESTROY, ct) < 0) {
-		/* bad luck, let's retry again */
-		ct->timeout.expires = jiffies +
-			(random32() % net->ct.sysctl_events_retry_timeout);
-		add_timer(&ct->timeout);
-		return;
+	/* Destroy all pending expectations */
+	if (nfct_help(ct)) {
+		spin_lock(&nf_conntrack_lock);
+		nf_ct_remove_expectations(ct);
+		spin_unlock(&nf_conntrack_lock);
 	}
-	/* we've got the event delivered, now it's dying */
-	set_bit(IPS_DYING_BIT, &ct->status);
-	nf_ct_put(ct);
+
+	nf_ct_add_to_dying_list(ct);
+	local_bh_enable();
 }
+EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
 
 void nf_ct_dying_timeout(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
 
-	/* set a new timer to retry event delivery */
-	setup_timer(&ct->timeout, death_by_event, (unsigned long)ct);
-	ct->timeout.expires = jiffies +
+	/* gc_worker() retries the event delivery once this passes; keep
+	 * it in the future so the retry loop there always moves on */
+	ct->timeout = jiffies + 1 +
 		(random32() % net->ct.sysctl_events_retry_timeout);
-	add_timer(&ct->timeout);
 }
 EXPORT_SYMBOL_GPL(nf_ct_dying_timeout);
 
-static void death_by_timeout(unsigned long ul_conntrack)
+/*
+ * Take a confirmed conntrack out of the hash.  Only the first caller
+ * gets to do it and to drop the reference held by the hash; returns
+ * false for everyone else.
+ */
+bool nf_ct_delete(struct nf_conn *ct, u32 pid, int report)
 {
-	struct nf_conn *ct = (void *)ul_conntrack;
 	struct nf_conn_tstamp *tstamp;
 
+	if (!nf_ct_is_confirmed(ct) ||
+	    test_and_set_bit(IPS_KILLED_BIT, &ct->status))
+		return false;
+
 	tstamp = nf_conn_tstamp_find(ct);
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_to_ns(ktime_get_real());
 
 	if (!test_bit(IPS_DYING_BIT, &ct->status) &&
-	    unlikely(nf_conntrack_event(IPCT_DESTROY, ct) < 0)) {
+	    unlikely(nf_conntrack_event_report(IPCT_DESTROY, ct,
+					       pid, report) < 0)) {
 		/* destroy event was not delivered */
 		nf_ct_delete_from_lists(ct);
 		nf_ct_dying_timeout(ct);
-		return;
+		return true;
 	}
 	set_bit(IPS_DYING_BIT, &ct->status);
 	nf_ct_delete_from_lists(ct);
 	nf_ct_put(ct);
+	return true;
 }
+EXPORT_SYMBOL_GPL(nf_ct_delete);
 
 #define SECS *HZ
 #define MINS * 60 SECS
@@ -321,27 +462,30 @@ static inline unsigned long ct_max_timeout(struct nf_conn *ct)
 	return 1 MINS;
 }
 
-static void ct_timeout(unsigned long ul_conntrack)
+/*
+ * The conntrack is due for its expiry check: kill it or, while some
+ * extra_timeout is left, push the check up to 60s ahead and trim what
+ * is left to what the current table load allows.  This races with
+ * __nf_ct_refresh_acct() just like the old 60s timer did; the next
+ * packet refreshes it again.
+ */
+static bool ct_timeout(struct nf_conn *ct)
 {
-	struct nf_conn *ct = (void *)ul_conntrack;
-
-	spin_lock_bh(&nf_conntrack_lock);
-	if (ct->extra_timeout == 0) {
-		spin_unlock_bh(&nf_conntrack_lock);
-		death_by_timeout(ul_conntrack);
-	} else {
-	    unsigned extra_jiffies;
-	    unsigned long old_timeout = ct->extra_timeout;
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - ct->timeout;
+	unsigned long extra = ct->extra_timeout;
+	unsigned long step;
 
-	    ct->extra_timeout = min(ct_max_timeout(ct), old_timeout);
-
-	    extra_jiffies = min(60u * HZ, ct->extra_timeout);
-	    ct->extra_timeout -= extra_jiffies;
-	    ct->timeout.expires = jiffies + extra_jiffies;
-	    add_timer(&ct->timeout);
+	if ((long)elapsed < 0 || test_bit(IPS_KILLED_BIT, &ct->status))
+		return false;
+	if ((long)elapsed >= (long)extra)
+		return nf_ct_delete(ct, 0, 0);
 
-	    spin_unlock_bh(&nf_conntrack_lock);
-	}
+	extra = min(ct_max_timeout(ct), extra - elapsed);
+	step = min(60ul * HZ, extra);
+	ct->extra_timeout = extra - step;
+	ct->timeout = now + step;
+	return false;
 }
 
 /*
@@ -349,7 +493,7 @@ static void ct_timeout(unsigned long ul_conntrack)
  * - Caller must take a reference on returned object
  *   and recheck nf_ct_tuple_equal(tuple, &h->tuple)
  * OR
- * - Caller must lock nf_conntrack_lock before calling this function
+ * - Caller must hold the bucket lock before calling this function
  */
 static struct nf_conntrack_tuple_hash *
 ____nf_conntrack_find(struct net *net, u16 zone,
@@ -418,6 +562,12 @@ begin:
 				nf_ct_put(ct);
 				goto begin;
 			}
+			if (unlikely(nf_ct_is_expired(ct))) {
+				/* expired but not reaped yet, do it now */
+				nf_ct_delete(ct, 0, 0);
+				nf_ct_put(ct);
+				h = NULL;
+			}
 		}
 	}
 	rcu_read_unlock();
@@ -450,18 +600,21 @@ int
 nf_conntrack_hash_check_insert(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, sequence;
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
 	u16 zone;
 
 	zone = nf_ct_zone(ct);
-	hash = hash_conntrack(net, zone,
-			      &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net, zone,
-				   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
 
-	spin_lock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		hash = hash_conntrack(net, zone,
+				      &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		repl_hash = hash_conntrack(net, zone,
+					   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (nf_conntrack_double_lock(hash, repl_hash, sequence));
 
 	/* See if there's one in the list already, including reverse */
 	hlist_nulls_for_each_entry(h, n, &net->ct.hash[hash], hnnode)
@@ -475,17 +628,18 @@ nf_conntrack_hash_check_insert(struct nf_conn *ct)
 		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
-	add_timer(&ct->timeout);
 	nf_conntrack_get(&ct->ct_general);
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	return 0;
 
 out:
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return -EEXIST;
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
@@ -494,7 +648,7 @@ EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
 int
 __nf_conntrack_confirm(struct sk_buff *skb)
 {
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, sequence;
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct nf_conn_help *help;
@@ -515,11 +669,16 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		return NF_ACCEPT;
 
 	zone = nf_ct_zone(ct);
-	/* reuse the hash saved before */
-	hash = *(unsigned long *)&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev;
-	hash = hash_bucket(hash, net);
-	repl_hash = hash_conntrack(net, zone,
-				   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	local_bh_disable();
+
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		/* reuse the hash saved before */
+		hash = *(unsigned long *)&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev;
+		hash = hash_bucket(hash, net);
+		repl_hash = hash_conntrack(net, zone,
+					   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (nf_conntrack_double_lock(hash, repl_hash, sequence));
 
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
@@ -531,15 +690,16 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	NF_CT_ASSERT(!nf_ct_is_confirmed(ct));
 	pr_debug("Confirming conntrack %p\n", ct);
 
-	spin_lock_bh(&nf_conntrack_lock);
-
-	/* We have to check the DYING flag inside the lock to prevent
+	/* We have to check the DYING flag after unlink to prevent
 	   a race against nf_ct_get_next_corpse() possibly called from
 	   user context, else we insert an already 'dead' hash, blocking
 	   further use of that particular connection -JM */
+	nf_ct_del_from_dying_or_unconfirmed_list(ct);
 
 	if (unlikely(nf_ct_is_dying(ct))) {
-		spin_unlock_bh(&nf_conntrack_lock);
+		nf_ct_add_to_dying_list(ct);
+		nf_conntrack_double_unlock(hash, repl_hash);
+		local_bh_enable();
 		return NF_ACCEPT;
 	}
 
@@ -557,14 +717,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
-	/* Remove from unconfirmed list */
-	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-
-	/* Timer relative to confirmation time, not original
-	   setting time, otherwise we'd get timer wrap in
+	/* Timeout relative to confirmation time, not original
+	   setting time, otherwise we'd get timeout wrap in
 	   weird delay cases. */
-	ct->timeout.expires += jiffies;
-	add_timer(&ct->timeout);
+	ct->timeout += jiffies;
 	atomic_inc(&ct->ct_general.use);
 	ct->status |= IPS_CONFIRMED;
 
@@ -577,13 +733,14 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		tstamp->start = ktime_to_ns(skb->tstamp);
 	}
 	/* Since the lookup is lockless, hash insertion must be done after
-	 * starting the timer and setting the CONFIRMED bit. The RCU barriers
+	 * setting the timeout and the CONFIRMED bit. The RCU barriers
 	 * guarantee that no other CPU can find the conntrack before the above
 	 * stores are visible.
 	 */
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	help = nfct_help(ct);
 	if (help && help->helper)
@@ -594,8 +751,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	return NF_ACCEPT;
 
 out:
+	nf_ct_add_to_dying_list(ct);
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return NF_DROP;
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_confirm);
@@ -652,7 +811,8 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
 					 hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
-			if (!test_bit(IPS_ASSURED_BIT, &tmp->status))
+			if (!test_bit(IPS_ASSURED_BIT, &tmp->status) ||
+			    nf_ct_is_expired(tmp))
 				ct = tmp;
 			cnt++;
 		}
@@ -675,8 +835,7 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 	if (!ct)
 		return dropped;
 
-	if (del_timer(&ct->timeout)) {
-		death_by_timeout((unsigned long)ct);
+	if (nf_ct_delete(ct, 0, 0)) {
 		/* Check if we indeed killed this entry. Reliable event
 		   delivery may have inserted it into the dying list. */
 		if (test_bit(IPS_DYING_BIT, &ct->status)) {
@@ -770,8 +929,6 @@ __nf_conntrack_alloc(struct net *net, u16 zone,
 	ct->tuplehash[IP_CT_DIR_REPLY].tuple = *repl;
 	/* save hash for reusing when confirming */
 	*(unsigned long *)(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev) = hash;
-	/* Don't set timer yet: wait for confirmation */
-	setup_timer(&ct->timeout, ct_timeout, (unsigned long)ct);
 	write_pnet(&ct->ct_net, net);
 #ifdef CONFIG_NF_CONNTRACK_ZONES
 	if (zone) {
@@ -852,44 +1009,58 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 
 	nf_ct_acct_ext_add(ct, GFP_ATOMIC);
 	nf_ct_tstamp_ext_add(ct, GFP_ATOMIC);
+	/* reserved up front, connlimit rules loaded later link the
+	 * conntrack on its next packet once it is confirmed */
+	if (ACCESS_ONCE(connlimit_destroy_conntrack))
+		nf_ct_connlimit_ext_add(ct, GFP_ATOMIC);
 
 	ecache = tmpl ? nf_ct_ecache_find(tmpl) : NULL;
 	nf_ct_ecache_ext_add(ct, ecache ? ecache->ctmask : 0,
 				 ecache ? ecache->expmask : 0,
 			     GFP_ATOMIC);
 
-	spin_lock_bh(&nf_conntrack_lock);
-	exp = nf_ct_find_expectation(net, zone, tuple);
-	if (exp) {
-		pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
-			 ct, exp);
-		/* Welcome, Mr. Bond.  We've been expecting you... */
-		__set_bit(IPS_EXPECTED_BIT, &ct->status);
-		ct->master = exp->master;
-		if (exp->helper) {
-			help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
-			if (help)
-				rcu_assign_pointer(help->helper, exp->helper);
-		}
+	local_bh_disable();
+	/* nf_conntrack_lock only guards the expectations, skip it when
+	 * there are none to find */
+	exp = NULL;
+	if (net->ct.expect_count) {
+		spin_lock(&nf_conntrack_lock);
+		exp = nf_ct_find_expectation(net, zone, tuple);
+		if (exp) {
+			pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
+				 ct, exp);
+			/* Welcome, Mr. Bond.  We've been expecting you... */
+			__set_bit(IPS_EXPECTED_BIT, &ct->status);
+			ct->master = exp->master;
+			if (exp->helper) {
+				help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
+				if (help)
+					rcu_assign_pointer(help->helper,
+							   exp->helper);
+			}
 
 #ifdef CONFIG_NF_CONNTRACK_MARK
-		ct->mark = exp->master->mark;
+			ct->mark = exp->master->mark;
 #endif
 #ifdef CONFIG_NF_CONNTRACK_SECMARK
-		ct->secmark = exp->master->secmark;
+			ct->secmark = exp->master->secmark;
 #endif
-		nf_conntrack_get(&ct->master->ct_general);
-		NF_CT_STAT_INC(net, expect_new);
-	} else {
+			nf_conntrack_get(&ct->master->ct_general);
+			NF_CT_STAT_INC(net, expect_new);
+		}
+		spin_unlock(&nf_conntrack_lock);
+	}
+	if (!exp) {
+		/* helpers are found under RCU, unregistering waits for
+		 * us to reach the unconfirmed list */
 		__nf_ct_try_assign_helper(ct, tmpl, GFP_ATOMIC);
 		NF_CT_STAT_INC(net, new);
 	}
 
 	/* Overload tuple linked list to put us in unconfirmed list. */
-	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-		       &net->ct.unconfirmed);
+	nf_ct_add_to_unconfirmed_list(ct);
 
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 
 	if (exp) {
 		if (exp->expectfn)
@@ -1145,7 +1316,9 @@ void nf_conntrack_change_ip(unsigned old_ip, unsigned new_ip)
     printk(KERN_INFO "nf_conntrack_change_ip %x -> %x\n", old_ip, new_ip);
     if (old_ip == 0 || new_ip == 0) return;
 
-    spin_lock_bh(&nf_conntrack_lock);
+    local_bh_disable();
+    nf_conntrack_all_lock();
+    write_seqcount_begin(&nf_conntrack_generation);
     rcu_read_lock();
 
     /* Traverse all hashed tuple entries */
@@ -1170,7 +1343,9 @@ void nf_conntrack_change_ip(unsigned old_ip, unsigned new_ip)
     }
 
     rcu_read_unlock();
-    spin_unlock_bh(&nf_conntrack_lock);
+    write_seqcount_end(&nf_conntrack_generation);
+    nf_conntrack_all_unlock();
+    local_bh_enable();
 }
 EXPORT_SYMBOL(nf_conntrack_change_ip);
 
@@ -1181,7 +1356,6 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 			  unsigned long extra_jiffies,
 			  int do_acct)
 {
-	NF_CT_ASSERT(ct->timeout.data == (unsigned long)ct);
 	NF_CT_ASSERT(skb);
 
 	/* Only update if this is not a fixed timeout */
@@ -1196,17 +1370,16 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 		ct->extra_timeout = 0;
 	}
 
-	/* If not in hash table, timer will not be active yet */
+	/* If not in hash table, the timeout is relative to confirmation */
 	if (!nf_ct_is_confirmed(ct)) {
-		ct->timeout.expires = extra_jiffies;
+		ct->timeout = extra_jiffies;
 	} else {
 		unsigned long newtime = jiffies + extra_jiffies;
 
 		/* Only update the timeout if the new timeout is at least
-		   HZ jiffies from the old timeout. Need del_timer for race
-		   avoidance (may already be dying). */
-		if (newtime - ct->timeout.expires >= HZ)
-			mod_timer_pending(&ct->timeout, newtime);
+		   HZ jiffies from the old timeout. */
+		if (newtime - ct->timeout >= HZ)
+			ct->timeout = newtime;
 	}
 
 acct:
@@ -1253,15 +1426,35 @@ bool __nf_ct_kill_acct(struct nf_conn *ct,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		ct->extra_timeout = 0;
-		ct->timeout.function((unsigned long)ct);
-		return true;
-	}
-	return false;
+	return nf_ct_delete(ct, 0, 0);
 }
 EXPORT_SYMBOL_GPL(__nf_ct_kill_acct);
 
+void (*connlimit_destroy_conntrack)(struct nf_conn *);
+EXPORT_SYMBOL(connlimit_destroy_conntrack);
+
+static void nf_ct_connlimit_destroy(struct nf_conn *ct)
+{
+	void (*destroy)(struct nf_conn *);
+
+	destroy = ACCESS_ONCE(connlimit_destroy_conntrack);
+	if (destroy)
+		destroy(ct);
+}
+
+static struct nf_ct_ext_type nf_ct_connlimit_extend __read_mostly = {
+	.len		= sizeof(struct nf_conn_connlimit),
+	.align		= __alignof__(struct nf_conn_connlimit),
+	.id		= NF_CT_EXT_CONNLIMIT,
+	.destroy	= nf_ct_connlimit_destroy,
+};
+
+static struct nf_ct_ext_type nf_ct_pcc_extend __read_mostly = {
+	.len	= sizeof(struct nf_conn_pcc),
+	.align	= __alignof__(struct nf_conn_pcc),
+	.id	= NF_CT_EXT_PCC,
+};
+
 #ifdef CONFIG_NF_CONNTRACK_ZONES
 static struct nf_ct_ext_type nf_ct_zone_extend __read_mostly = {
 	.len	= sizeof(struct nf_conntrack_zone),
@@ -1344,25 +1537,39 @@ get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
 	for (; *bucket < net->ct.htable_size; (*bucket)++) {
-		hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket], hnnode) {
+		local_bh_disable();
+		nf_conntrack_lock_bucket(*bucket);
+		if (*bucket < net->ct.htable_size) {
+			hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket],
+						   hnnode) {
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				if (iter(ct, data))
+					goto found;
+			}
+		}
+		nf_conntrack_unlock_bucket(*bucket);
+		local_bh_enable();
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->unconfirmed, hnnode) {
 			ct = nf_ct_tuplehash_to_ctrack(h);
 			if (iter(ct, data))
-				goto found;
+				set_bit(IPS_DYING_BIT, &ct->status);
 		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	hlist_nulls_for_each_entry(h, n, &net->ct.unconfirmed, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		if (iter(ct, data))
-			set_bit(IPS_DYING_BIT, &ct->status);
-	}
-	spin_unlock_bh(&nf_conntrack_lock);
 	return NULL;
 found:
 	atomic_inc(&ct->ct_general.use);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_unlock_bucket(*bucket);
+	local_bh_enable();
 	return ct;
 }
 
@@ -1375,9 +1582,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
-			death_by_timeout((unsigned long)ct);
-		/* ... else the timer will get him soon. */
+		nf_ct_delete(ct, 0, 0);
 
 		nf_ct_put(ct);
 	}
@@ -1398,12 +1603,12 @@ static int kill_report(struct nf_conn *i, void *data)
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_to_ns(ktime_get_real());
 
-	/* If we fail to deliver the event, death_by_timeout() will retry */
+	/* If we fail to deliver the event, gc_worker() will retry */
 	if (nf_conntrack_event_report(IPCT_DESTROY, i,
 				      fr->pid, fr->report) < 0)
 		return 1;
 
-	/* Avoid the delivery of the destroy event in death_by_timeout(). */
+	/* Avoid the delivery of the destroy event in nf_ct_delete(). */
 	set_bit(IPS_DYING_BIT, &i->status);
 	return 1;
 }
@@ -1433,19 +1638,141 @@ void nf_conntrack_flush_report(struct net *net, u32 pid, int report)
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_flush_report);
 
-static void nf_ct_release_dying_list(struct net *net)
+#define GC_MAX_BUCKETS_DIV	64u
+#define GC_MAX_BUCKETS		8192u
+#define GC_MAX_EVICTS		256u
+#define GC_INTERVAL		HZ
+#define GC_DYING_BATCH		16
+
+/*
+ * Collect up to GC_DYING_BATCH conntracks from a dying list that are
+ * due for a retry, starting after @last, or at the head if it is NULL.
+ */
+static unsigned int nf_ct_gc_dying_batch(struct ct_pcpu *pcpu,
+					 struct nf_conn *last, bool force,
+					 struct nf_conn **batch)
 {
 	struct nf_conntrack_tuple_hash *h;
-	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	unsigned int cnt = 0;
+
+	spin_lock_bh(&pcpu->lock);
+	n = pcpu->dying.first;
+	if (last)
+		n = last->tuplehash[IP_CT_DIR_ORIGINAL].hnnode.next;
+	hlist_nulls_for_each_entry_from(h, n, hnnode) {
+		struct nf_conn *ct = nf_ct_tuplehash_to_ctrack(h);
+
+		if (nf_ct_is_dying(ct) ||
+		    (!force && time_before(jiffies, ct->timeout)))
+			continue;
+		/* still holds the hash reference */
+		atomic_inc(&ct->ct_general.use);
+		batch[cnt++] = ct;
+		if (cnt == GC_DYING_BATCH)
+			break;
+	}
+	spin_unlock_bh(&pcpu->lock);
+	return cnt;
+}
 
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_for_each_entry(h, n, &net->ct.dying, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		/* never fails to remove them, no listeners at this point */
-		nf_ct_kill(ct);
+/*
+ * Retry the destroy event of conntracks whose delivery failed.  Only
+ * called from gc_worker(), or with it stopped, so a conntrack is never
+ * retried twice at once.  Each dying list is walked once: the last
+ * conntrack of a full batch stays referenced, so it is still on the
+ * list when the walk goes on from it.
+ */
+static void nf_ct_gc_dying(struct net *net, bool force)
+{
+	struct nf_conn *batch[GC_DYING_BATCH];
+	unsigned int i, cnt;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+		struct nf_conn *last = NULL;
+
+		do {
+			cnt = nf_ct_gc_dying_batch(pcpu, last, force, batch);
+			if (last)
+				nf_ct_put(last);
+			last = NULL;
+
+			for (i = 0; i < cnt; i++) {
+				struct nf_conn *ct = batch[i];
+
+				if (nf_conntrack_event(IPCT_DESTROY, ct) < 0) {
+					/* bad luck, let's retry again */
+					nf_ct_dying_timeout(ct);
+				} else {
+					/* delivered, now it's dying */
+					set_bit(IPS_DYING_BIT, &ct->status);
+					nf_ct_put(ct);
+				}
+				if (cnt == GC_DYING_BATCH && i == cnt - 1)
+					last = ct;
+				else
+					nf_ct_put(ct);
+			}
+			cond_resched();
+		} while (last);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
+}
+
+/*
+ * Walk 1/GC_MAX_BUCKETS_DIV of the hash each GC_INTERVAL, so every
+ * conntrack gets its expiry check about once a minute, the same pace
+ * the per-conntrack 60s timer had.  Conntracks that keep passing
+ * packets are expired by the lookup instead.
+ */
+static void gc_worker(struct work_struct *work)
+{
+	struct net *net = container_of(to_delayed_work(work), struct net,
+				       ct.gc_work);
+	unsigned int bucket = net->ct.gc_bucket;
+	unsigned int goal, scanned = 0, expired = 0;
+	unsigned long delay = GC_INTERVAL;
+
+	goal = clamp(net->ct.htable_size / GC_MAX_BUCKETS_DIV,
+		     1u, GC_MAX_BUCKETS);
+	do {
+		struct nf_conntrack_tuple_hash *h;
+		struct hlist_nulls_node *n;
+
+		rcu_read_lock();
+		local_bh_disable();
+		if (bucket >= net->ct.htable_size)
+			bucket = 0;
+		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket],
+					       hnnode) {
+			struct nf_conn *ct = nf_ct_tuplehash_to_ctrack(h);
+
+			/* each conntrack is on two chains, look at it once */
+			if (NF_CT_DIRECTION(h) != IP_CT_DIR_ORIGINAL ||
+			    time_before(jiffies, ct->timeout))
+				continue;
+			if (!atomic_inc_not_zero(&ct->ct_general.use))
+				continue;
+			/* it may have been freed and reused meanwhile */
+			if (nf_ct_is_confirmed(ct) && ct_timeout(ct))
+				expired++;
+			nf_ct_put(ct);
+		}
+		local_bh_enable();
+		rcu_read_unlock();
+		cond_resched();
+		bucket++;
+	} while (++scanned < goal && expired < GC_MAX_EVICTS);
+	net->ct.gc_bucket = bucket;
+
+	/* every retry that is due, not one batch per interval */
+	nf_ct_gc_dying(net, false);
+
+	/* plenty of expired ones left, come back right away */
+	if (expired >= GC_MAX_EVICTS)
+		delay = 1;
+	queue_delayed_work(system_nrt_wq, &net->ct.gc_work, delay);
 }
 
 static int untrack_refs(void)
@@ -1470,13 +1797,17 @@ static void nf_conntrack_cleanup_init_net(void)
 #ifdef CONFIG_NF_CONNTRACK_ZONES
 	nf_ct_extend_unregister(&nf_ct_zone_extend);
 #endif
+	nf_ct_extend_unregister(&nf_ct_pcc_extend);
+	nf_ct_extend_unregister(&nf_ct_connlimit_extend);
 }
 
 static void nf_conntrack_cleanup_net(struct net *net)
 {
+	cancel_delayed_work_sync(&net->ct.gc_work);
  i_see_dead_people:
 	nf_ct_iterate_cleanup(net, kill_all, NULL);
-	nf_ct_release_dying_list(net);
+	/* never fails to remove them, no listeners at this point */
+	nf_ct_gc_dying(net, true);
 	if (atomic_read(&net->ct.count) != 0) {
 		schedule();
 		goto i_see_dead_people;
@@ -1490,6 +1821,7 @@ static void nf_conntrack_cleanup_net(struct net *net)
 	kmem_cache_destroy(net->ct.nf_conntrack_cachep);
 	kfree(net->ct.slabname);
 	free_percpu(net->ct.stat);
+	free_percpu(net->ct.pcpu_lists);
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1564,7 +1896,9 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	 * created because of a false negative won't make it into the hash
 	 * though since that required taking the lock.
 	 */
-	spin_lock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	nf_conntrack_all_lock();
+	write_seqcount_begin(&nf_conntrack_generation);
 	for (i = 0; i < init_net.ct.htable_size; i++) {
 		while (!hlist_nulls_empty(&init_net.ct.hash[i])) {
 			h = hlist_nulls_entry(init_net.ct.hash[i].first,
@@ -1581,7 +1915,9 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 
 	init_net.ct.htable_size = nf_conntrack_htable_size = hashsize;
 	init_net.ct.hash = hash;
-	spin_unlock_bh(&nf_conntrack_lock);
+	write_seqcount_end(&nf_conntrack_generation);
+	nf_conntrack_all_unlock();
+	local_bh_enable();
 
 	nf_ct_free_hashtable(old_hash, old_size);
 	return 0;
@@ -1603,7 +1939,10 @@ EXPORT_SYMBOL_GPL(nf_ct_untracked_status_or);
 static int nf_conntrack_init_init_net(void)
 {
 	int max_factor = 8;
-	int ret, cpu;
+	int ret, cpu, i;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
 
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
 	 * machine has 512 buckets. >= 1GB machines have 16384 buckets. */
@@ -1642,6 +1981,12 @@ static int nf_conntrack_init_init_net(void)
 	if (ret < 0)
 		goto err_extend;
 #endif
+	ret = nf_ct_extend_register(&nf_ct_connlimit_extend);
+	if (ret < 0)
+		goto err_connlimit;
+	ret = nf_ct_extend_register(&nf_ct_pcc_extend);
+	if (ret < 0)
+		goto err_pcc;
 	/* Set up fake conntrack: to never be deleted, not in any hashes */
 	for_each_possible_cpu(cpu) {
 		struct nf_conn *ct = &per_cpu(nf_conntrack_untracked, cpu);
@@ -1652,10 +1997,14 @@ static int nf_conntrack_init_init_net(void)
 	nf_ct_untracked_status_or(IPS_CONFIRMED | IPS_UNTRACKED);
 	return 0;
 
+err_pcc:
+	nf_ct_extend_unregister(&nf_ct_connlimit_extend);
+err_connlimit:
 #ifdef CONFIG_NF_CONNTRACK_ZONES
+	nf_ct_extend_unregister(&nf_ct_zone_extend);
 err_extend:
-	nf_conntrack_helper_fini();
 #endif
+	nf_conntrack_helper_fini();
 err_helper:
 	nf_conntrack_proto_fini();
 err_proto:
@@ -1670,11 +2019,25 @@ err_proto:
 
 static int nf_conntrack_init_net(struct net *net)
 {
-	int ret;
+	int ret, cpu;
 
 	atomic_set(&net->ct.count, 0);
-	INIT_HLIST_NULLS_HEAD(&net->ct.unconfirmed, UNCONFIRMED_NULLS_VAL);
-	INIT_HLIST_NULLS_HEAD(&net->ct.dying, DYING_NULLS_VAL);
+	INIT_DELAYED_WORK(&net->ct.gc_work, gc_worker);
+	net->ct.gc_bucket = 0;
+
+	net->ct.pcpu_lists = alloc_percpu(struct ct_pcpu);
+	if (!net->ct.pcpu_lists) {
+		ret = -ENOMEM;
+		goto err_pcpu_lists;
+	}
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_init(&pcpu->lock);
+		INIT_HLIST_NULLS_HEAD(&pcpu->unconfirmed, UNCONFIRMED_NULLS_VAL);
+		INIT_HLIST_NULLS_HEAD(&pcpu->dying, DYING_NULLS_VAL);
+	}
+
 	net->ct.stat = alloc_percpu(struct ip_conntrack_stat);
 	if (!net->ct.stat) {
 		ret = -ENOMEM;
@@ -1716,6 +2079,7 @@ static int nf_conntrack_init_net(struct net *net)
 	if (ret < 0)
 		goto err_ecache;
 
+	queue_delayed_work(system_nrt_wq, &net->ct.gc_work, GC_INTERVAL);
 	return 0;
 
 err_ecache:
@@ -1733,6 +2097,8 @@ err_cache:
 err_slabname:
 	free_percpu(net->ct.stat);
 err_stat:
+	free_percpu(net->ct.pcpu_lists);
+err_pcpu_lists:
 	return ret;
 }
 
@@ -135,10 +135,7 @@ nla_put_failure:
 static inline int
 ctnetlink_dump_timeout(struct sk_buff *skb, const struct nf_conn *ct)
 {
-	long timeout = ((long) ct->timeout.expires - (long) jiffies + ct->extra_timeout) / HZ;
-
-	if (timeout < 0)
-		timeout = 0;
+	long timeout = nf_ct_expires(ct) / HZ;
 
 	NLA_PUT_BE32(skb, CTA_TIMEOUT, htonl(timeout));
 	return 0;
@@ -204,7 +201,7 @@ nla_put_failure:
 
 static int
 dump_counters(struct sk_buff *skb, u64 pkts, u64 bytes, u64 fppkts, u64 fpbytes, u32 rate,
-	      enum ip_conntrack_dir dir)
+	      u32 fp_counter, enum ip_conntrack_dir dir)
 {
 	enum ctattr_type type = dir ? CTA_COUNTERS_REPLY: CTA_COUNTERS_ORIG;
 	struct nlattr *nest_count;
@@ -218,6 +215,9 @@ dump_counters(struct sk_buff *skb, u64 pkts, u64 bytes, u64 fppkts, u64 fpbytes,
 	NLA_PUT_BE64(skb, CTA_COUNTERS_FP_PACKETS, cpu_to_be64(fppkts));
 	NLA_PUT_BE64(skb, CTA_COUNTERS_FP_BYTES, cpu_to_be64(fpbytes));
 	NLA_PUT_BE32(skb, CTA_COUNTERS_RATE, cpu_to_be32(rate));
+	if (fp_counter)
+		NLA_PUT_BE32(skb, CTA_COUNTERS_FP_COUNTER,
+			     cpu_to_be32(fp_counter));
 
 	nla_nest_end(skb, nest_count);
 
@@ -240,20 +240,28 @@ ctnetlink_dump_counters(struct sk_buff *skb, const struct nf_conn *ct,
 		return 0;
 
 	if (type == IPCTNL_MSG_CT_GET_CTRZERO) {
+		u64 slot_pkts, slot_bytes;
+
+		/* the slot is only written by the fast path, zero the sum
+		 * by pulling the atomic part below zero
+		 */
+		fp_counter_read(acct[dir].fp_counter, &slot_pkts, &slot_bytes);
 		pkts = atomic64_xchg(&acct[dir].packets, 0);
 		bytes = atomic64_xchg(&acct[dir].bytes, 0);
-		fppkts = atomic64_xchg(&acct[dir].fp_packets, 0);
-		fpbytes = atomic64_xchg(&acct[dir].fp_bytes, 0);
+		fppkts = atomic64_xchg(&acct[dir].fp_packets, -slot_pkts);
+		fpbytes = atomic64_xchg(&acct[dir].fp_bytes, -slot_bytes);
+		fppkts += slot_pkts;
+		fpbytes += slot_bytes;
 	} else {
 		pkts = atomic64_read(&acct[dir].packets);
 		bytes = atomic64_read(&acct[dir].bytes);
-		fppkts = atomic64_read(&acct[dir].fp_packets);
-		fpbytes = atomic64_read(&acct[dir].fp_bytes);
+		nf_ct_acct_fp_read(&acct[dir], &fppkts, &fpbytes);
 	}
 	if (time_before(jiffies, acct[dir].second_end_jiffies + HZ)) {
 		rate = atomic_read(&acct[dir].bytes_prev_second);
 	}
-	return dump_counters(skb, pkts, bytes, fppkts, fpbytes, rate, dir);
+	return dump_counters(skb, pkts, bytes, fppkts, fpbytes, rate,
+			     acct[dir].fp_counter, dir);
 }
 
 static int
@@ -717,9 +725,14 @@ ctnetlink_dump_table(struct sk_buff *skb, struct netlink_callback *cb)
 	struct nfgenmsg *nfmsg = nlmsg_data(cb->nlh);
 	u_int8_t l3proto = nfmsg->nfgen_family;
 
-	spin_lock_bh(&nf_conntrack_lock);
 	last = (struct nf_conn *)cb->args[1];
+	local_bh_disable();
 	for (; cb->args[0] < net->ct.htable_size; cb->args[0]++) {
+		nf_conntrack_lock_bucket(cb->args[0]);
+		if (cb->args[0] >= net->ct.htable_size) {
+			nf_conntrack_unlock_bucket(cb->args[0]);
+			break;
+		}
 restart:
 		hlist_nulls_for_each_entry(h, n, &net->ct.hash[cb->args[0]],
 					 hnnode) {
@@ -743,6 +756,7 @@ restart:
 						ct) < 0) {
 				nf_conntrack_get(&ct->ct_general);
 				cb->args[1] = (unsigned long)ct;
+				nf_conntrack_unlock_bucket(cb->args[0]);
 				goto out;
 			}
 		}
@@ -750,9 +764,10 @@ restart:
 			cb->args[1] = 0;
 			goto restart;
 		}
+		nf_conntrack_unlock_bucket(cb->args[0]);
 	}
 out:
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 	if (last)
 		nf_ct_put(last);
 
@@ -956,21 +971,7 @@ ctnetlink_del_conntrack(struct sock *ctnl, struct sk_buff *skb,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		if (nf_conntrack_event_report(IPCT_DESTROY, ct,
-					      NETLINK_CB(skb).pid,
-					      nlmsg_report(nlh)) < 0) {
-			nf_ct_delete_from_lists(ct);
-			/* we failed to report the event, try later */
-			nf_ct_dying_timeout(ct);
-			nf_ct_put(ct);
-			return 0;
-		}
-		/* death_by_timeout would report the event again */
-		set_bit(IPS_DYING_BIT, &ct->status);
-		nf_ct_delete_from_lists(ct);
-		nf_ct_put(ct);
-	}
+	nf_ct_delete(ct, NETLINK_CB(skb).pid, nlmsg_report(nlh));
 	nf_ct_put(ct);
 
 	return 0;
@@ -1080,7 +1081,7 @@ ctnetlink_change_status(struct nf_conn *ct, const struct nlattr * const cda[])
 	unsigned int status = ntohl(nla_get_be32(cda[CTA_STATUS]));
 	d = ct->status ^ status;
 
-	if (d & (IPS_EXPECTED|IPS_CONFIRMED|IPS_DYING))
+	if (d & (IPS_EXPECTED|IPS_CONFIRMED|IPS_DYING|IPS_KILLED))
 		/* unchangeable */
 		return -EBUSY;
 
@@ -1193,12 +1194,11 @@ ctnetlink_change_timeout(struct nf_conn *ct, const struct nlattr * const cda[])
 {
 	u_int32_t timeout = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
 
-	if (!del_timer(&ct->timeout))
+	if (test_bit(IPS_KILLED_BIT, &ct->status))
 		return -ETIME;
 
-	ct->timeout.expires = jiffies + timeout * HZ;
 	ct->extra_timeout = 0;
-	add_timer(&ct->timeout);
+	ct->timeout = jiffies + timeout * HZ;
 
 	return 0;
 }
@@ -1363,9 +1363,9 @@ ctnetlink_create_conntrack(struct net *net, u16 zone,
 
 	if (!cda[CTA_TIMEOUT])
 		goto err1;
-	ct->timeout.expires = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
+	ct->timeout = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
 
-	ct->timeout.expires = jiffies + ct->timeout.expires * HZ;
+	ct->timeout = jiffies + ct->timeout * HZ;
 	ct->extra_timeout = 0;
 
 	rcu_read_lock();
@@ -194,9 +194,8 @@ static int ct_seq_show(struct seq_file *s, void *v)
 	if (seq_printf(s, "%-8s %u %-8s %u %ld ",
 		       l3proto->name, nf_ct_l3num(ct),
 		       l4proto->name, nf_ct_protonum(ct),
-		       timer_pending(&ct->timeout)
-		       ? (long)(ct->timeout.expires + ct->extra_timeout
-				- jiffies)/HZ : 0) != 0)
+		       nf_ct_is_confirmed(ct)
+		       ? nf_ct_expires(ct) / HZ : 0) != 0)
 		goto release;
 
 	if (l4proto->print_conntrack && l4proto->print_conntrack(s, ct))
@@ -928,6 +928,7 @@ qdisc_create(struct net_device *dev, struct netdev_queue *dev_queue,
 	}
 err_out3:
 	dev_put(dev);
+	qdisc_free_rings(sch);
 	kfree((char *) sch - sch->padded);
 err_out2:
 	module_put(ops->owner);
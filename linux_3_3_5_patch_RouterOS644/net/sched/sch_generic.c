@@ -50,10 +50,91 @@ static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 	return 0;
 }
 
+/* Called with BH disabled, returns false when the ring of this cpu is
+ * full or the qdisc has none, the caller then enqueues under the lock.
+ * The caller is expected to __netif_schedule() the qdisc afterwards.
+ */
+bool qdisc_enqueue_ring(struct Qdisc *q, struct sk_buff *skb, u32 classid)
+{
+	struct qdisc_enq_ring *ring;
+	unsigned int head;
+
+	if (!q->enq_rings)
+		return false;
+
+	ring = this_cpu_ptr(q->enq_rings);
+	head = ring->head;
+	if (head - ACCESS_ONCE(ring->tail) >= QDISC_ENQ_RING_SIZE)
+		return false;
+
+	ring->entry[head % QDISC_ENQ_RING_SIZE].skb = skb;
+	ring->entry[head % QDISC_ENQ_RING_SIZE].classid = classid;
+	smp_wmb();
+	ACCESS_ONCE(ring->head) = head + 1;
+
+	/* pairs with the barrier in qdisc_drain_rings(): either it sees
+	 * our head or we see our bit cleared and set it again */
+	smp_mb();
+	if (!cpumask_test_cpu(smp_processor_id(), q->enq_pending))
+		cpumask_set_cpu(smp_processor_id(), q->enq_pending);
+	return true;
+}
+EXPORT_SYMBOL(qdisc_enqueue_ring);
+
+static void qdisc_enq_ring_flush(struct Qdisc *q, struct qdisc_enq_ring *ring,
+				 bool enqueue)
+{
+	unsigned int head = ACCESS_ONCE(ring->head);
+	unsigned int tail = ring->tail;
+
+	if (head == tail)
+		return;
+
+	smp_rmb();
+	for (; tail != head; tail++) {
+		struct sk_buff *skb = ring->entry[tail % QDISC_ENQ_RING_SIZE].skb;
+		u32 classid = ring->entry[tail % QDISC_ENQ_RING_SIZE].classid;
+
+		if (!enqueue) {
+			kfree_skb(skb);
+		} else if (!classid) {
+			q->enqueue(skb, q);
+		} else if (!q->ops->enqueue_classified(skb, q, classid)) {
+			/* the class went away while the packet was queued */
+			q->qstats.drops++;
+			kfree_skb(skb);
+		}
+	}
+	smp_mb();
+	ACCESS_ONCE(ring->tail) = tail;
+}
+
+/* Under qdisc_lock(q), moves what the rings hold into the qdisc. */
+void qdisc_drain_rings(struct Qdisc *q)
+{
+	int cpu;
+
+	for_each_cpu(cpu, q->enq_pending) {
+		cpumask_clear_cpu(cpu, q->enq_pending);
+		smp_mb__after_clear_bit();
+		qdisc_enq_ring_flush(q, per_cpu_ptr(q->enq_rings, cpu), true);
+	}
+}
+EXPORT_SYMBOL(qdisc_drain_rings);
+
+void qdisc_free_rings(struct Qdisc *q)
+{
+	free_percpu(q->enq_rings);
+	free_cpumask_var(q->enq_pending);
+}
+
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
 
+	if (q->enq_rings && !cpumask_empty(q->enq_pending))
+		qdisc_drain_rings(q);
+
 	if (unlikely(skb)) {
 		struct net_device *dev = qdisc_dev(q);
 		struct netdev_queue *txq;
@@ -592,6 +673,16 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	sch->enqueue = ops->enqueue;
 	sch->dequeue = ops->dequeue;
 	sch->dev_queue = dev_queue;
+	if (ops->enqueue_classified &&
+	    (qdisc_dev(sch)->priv_flags & IFF_ENQ_RINGS)) {
+		sch->enq_rings = alloc_percpu(struct qdisc_enq_ring);
+		if (!sch->enq_rings ||
+		    !zalloc_cpumask_var(&sch->enq_pending, GFP_KERNEL)) {
+			free_percpu(sch->enq_rings);
+			kfree(p);
+			goto errout;
+		}
+	}
 	dev_hold(qdisc_dev(sch));
 	atomic_set(&sch->refcnt, 1);
 
@@ -628,6 +719,15 @@ void qdisc_reset(struct Qdisc *qdisc)
 	if (ops->reset)
 		ops->reset(qdisc);
 
+	if (qdisc->enq_rings) {
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			qdisc_enq_ring_flush(qdisc,
+					     per_cpu_ptr(qdisc->enq_rings, cpu),
+					     false);
+	}
+
 	if (qdisc->gso_skb) {
 		kfree_skb(qdisc->gso_skb);
 		qdisc->gso_skb = NULL;
@@ -640,6 +740,16 @@ static void qdisc_rcu_free(struct rcu_head *head)
 {
 	struct Qdisc *qdisc = container_of(head, struct Qdisc, rcu_head);
 
+	if (qdisc->enq_rings) {
+		int cpu;
+
+		/* a producer may still have raced with qdisc_destroy() */
+		for_each_possible_cpu(cpu)
+			qdisc_enq_ring_flush(qdisc,
+					     per_cpu_ptr(qdisc->enq_rings, cpu),
+					     false);
+		qdisc_free_rings(qdisc);
+	}
 	kfree((char *) qdisc - qdisc->padded);
 }
 
@@ -38,6 +38,9 @@
 #include <linux/workqueue.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/radix-tree.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <net/netlink.h>
 #include <net/pkt_sched.h>
 #include <asm/div64.h>
@@ -57,8 +60,9 @@
 
 static int htb_hysteresis __read_mostly = 0; /* whether to use mode hysteresis for speedup */
 #define HTB_VER 0x30011		/* major must be matched with number suplied by TC as version */
-#define HTB_RATEMEASURE 16 /* count of rate measurements to keep in memory */
-#define HTB_RATESHIFT 4 /* bits to shift to get avg rate from sum */
+#define HTB_RATEMEASURE 16 /* rate measurements per burst interval */
+#define HTB_RATE_EWMA_LOG 4 /* burst rate average weight, 1/HTB_RATEMEASURE */
+#define HTB_RATE_MAX_DECAY 64 /* measurements after which the old average is gone */
 
 #if HTB_VER >> 16 != TC_HTB_PROTOVER
 #error "Mismatched sch_htb.c and pkt_sch.h"
@@ -75,8 +79,6 @@ enum htb_cmode {
 	HTB_CAN_SEND		/* class can send */
 };
 
-atomic_t burst_class_count = ATOMIC_INIT(0);
-
 /* interior & leaf nodes; props specific to leaves are marked L: */
 struct htb_class {
 	struct Qdisc_class_common common;
@@ -86,8 +88,6 @@ struct htb_class {
 	struct gnet_stats_rate_est rate_est;
 	struct tc_htb_xstats xstats;	/* our special stats */
 	int refcnt;		/* usage count of this class */
-	atomic_t dead;
-	struct net_device *dev;
 
 	/* topology */
 	int level;		/* our level (see above) */
@@ -134,12 +134,9 @@ struct htb_class {
 	unsigned thr_ceil;         /* threshold above which we switch to ceil */
 	unsigned thr_burst;        /* threshold below which we switch to burst */
 	unsigned measure_interval; /* rate measure interval in jiffies */
-	unsigned rates[HTB_RATEMEASURE]; /* rates for previous time intervals */
-	unsigned rate_index;             /* last filled rate in 'rates' array */
-	unsigned long long rate_sum;     /* sum of 'rates' array */
-	unsigned long long prev_bytes;   /* stat bytes at prev timer execution */
-	struct timer_list burst_timer;   /* burst rate limiting */
-	struct Qdisc *qdisc;   /* needed to get lock */
+	unsigned avg_rate;         /* moving average of the rate, bytes/s */
+	u64 burst_bytes;           /* bytes sent since burst_stamp */
+	unsigned long burst_stamp; /* start of the current measurement */
 
 	long buffer, cbuffer;	/* token bucket depth/rate */
 	long acbuffer, bbuffer;
@@ -149,7 +146,10 @@ struct htb_class {
 };
 
 struct htb_sched {
-	struct Qdisc_class_hash clhash;
+	struct Qdisc_class_hash clhash;	/* for walking all classes */
+	struct radix_tree_root classes;	/* by classid minor, for lookups */
+	struct list_head list;		/* on htb_list */
+	u32 id;				/* position on htb_list */
 	struct list_head drops[TC_HTB_NUMPRIO];/* active leaves (for drops) */
 
 	/* self list - roots of self generating tree */
@@ -184,16 +184,24 @@ struct htb_sched {
 	struct work_struct work;
 };
 
-/* find class in global hash table using given handle */
+/* all htb qdiscs, ordered by id, for /proc/net/htb_stats */
+static LIST_HEAD(htb_list);
+static DEFINE_MUTEX(htb_list_lock);
+static u32 htb_next_id;
+
+/* find class using given handle, the radix tree does not need rehashing
+ * as the hash did, which was taking the tree lock for long with many
+ * thousands of classes
+ */
 static inline struct htb_class *htb_find(u32 handle, struct Qdisc *sch)
 {
 	struct htb_sched *q = qdisc_priv(sch);
-	struct Qdisc_class_common *clc;
+	struct htb_class *cl;
 
-	clc = qdisc_class_find(&q->clhash, handle);
-	if (clc == NULL)
+	cl = radix_tree_lookup(&q->classes, TC_H_MIN(handle));
+	if (cl == NULL || cl->common.classid != handle)
 		return NULL;
-	return container_of(clc, struct htb_class, common);
+	return cl;
 }
 
 /**
@@ -670,54 +678,51 @@ static inline void htb_accnt_tokens(struct htb_class *cl, int bytes, long diff)
 	cl->tokens = toks;
 }
 
-static void htb_burst_timer(unsigned long arg) {
-    struct htb_class *cl = (struct htb_class *)arg;
-    struct Qdisc *sch = cl->qdisc;
-    spinlock_t *lock = qdisc_lock(sch);
-    unsigned long long current_rate;
-    unsigned avg_rate;
-
-    spin_lock(lock);
-
-    if (atomic_read(&cl->dead)) {
-	    spin_unlock(lock);
-	    dev_put(cl->dev);
-	    kfree(cl);
-	    atomic_dec(&burst_class_count);
-	    return;
-    }
-
-    current_rate = cl->bstats.bytes - cl->prev_bytes;
-    current_rate = current_rate * HZ;
-    do_div(current_rate, cl->measure_interval);
-    cl->prev_bytes = cl->bstats.bytes;
-
-    cl->rates[cl->rate_index] = current_rate;
-    cl->rate_sum += current_rate;
-    ++cl->rate_index;
-    if (cl->rate_index == HTB_RATEMEASURE) cl->rate_index = 0;
-    avg_rate = cl->rate_sum >> HTB_RATESHIFT;
-    cl->rate_sum -= cl->rates[cl->rate_index];
-
-    if (cl->actual_ceil == cl->burst) {
-	if (avg_rate > cl->thr_ceil) {
-	    // switch to ceil
-	    cl->actual_ceil = cl->ceil;
-	    cl->acbuffer = cl->cbuffer;
-	}
-    }
-    else {
-	if (avg_rate < cl->thr_burst) {
-	    // switch to burst
-	    cl->actual_ceil = cl->burst;
-	    cl->acbuffer = cl->bbuffer;
-	}
-    }
+/* Burst rate is averaged lazily when the class is charged, instead of
+ * sampling it from a timer. Measurements the class was idle for are folded
+ * in at once, so idle classes cost nothing until they send again.
+ */
+static void htb_burst_update(struct htb_class *cl, int bytes)
+{
+	unsigned long elapsed = jiffies - cl->burst_stamp;
+	unsigned long n;
+	u64 sample;
 
-    cl->burst_timer.expires = jiffies + cl->measure_interval;
-    add_timer(&cl->burst_timer);
+	cl->burst_bytes += bytes;
+	if (elapsed < cl->measure_interval)
+		return;
 
-    spin_unlock(lock);
+	n = elapsed / cl->measure_interval;
+	sample = cl->burst_bytes * HZ;
+	do_div(sample, n * cl->measure_interval);
+	/* avg_rate is 32 bit */
+	if (sample > UINT_MAX)
+		sample = UINT_MAX;
+	cl->burst_stamp += n * cl->measure_interval;
+	cl->burst_bytes = 0;
+
+	if (n > HTB_RATE_MAX_DECAY)
+		n = HTB_RATE_MAX_DECAY;
+	while (n--) {
+		if (sample > cl->avg_rate)
+			cl->avg_rate += (sample - cl->avg_rate) >> HTB_RATE_EWMA_LOG;
+		else
+			cl->avg_rate -= (cl->avg_rate - sample) >> HTB_RATE_EWMA_LOG;
+	}
+
+	if (cl->actual_ceil == cl->burst) {
+		if (cl->avg_rate > cl->thr_ceil) {
+			/* switch to ceil */
+			cl->actual_ceil = cl->ceil;
+			cl->acbuffer = cl->cbuffer;
+		}
+	} else {
+		if (cl->avg_rate < cl->thr_burst) {
+			/* switch to burst */
+			cl->actual_ceil = cl->burst;
+			cl->acbuffer = cl->bbuffer;
+		}
+	}
 }
 
 static inline void htb_accnt_ctokens(struct htb_class *cl, int bytes, long diff)
@@ -761,6 +766,8 @@ static void htb_charge_class(struct htb_sched *q, struct htb_class *cl,
 			cl->xstats.borrows++;
 			cl->tokens += diff;	/* we moved t_c; update tokens */
 		}
+		if (cl->burst)
+			htb_burst_update(cl, bytes);
 		htb_accnt_ctokens(cl, bytes, diff);
 		cl->t_c = q->now;
 
@@ -1139,6 +1146,7 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt)
 	err = qdisc_class_hash_init(&q->clhash);
 	if (err < 0)
 		return err;
+	INIT_RADIX_TREE(&q->classes, GFP_ATOMIC);
 	for (i = 0; i < TC_HTB_NUMPRIO; i++)
 		INIT_LIST_HEAD(q->drops + i);
 
@@ -1152,6 +1160,10 @@ static int htb_init(struct Qdisc *sch, struct nlattr *opt)
 		q->rate2quantum = 1;
 	q->defcls = gopt->defcls;
 
+	mutex_lock(&htb_list_lock);
+	q->id = htb_next_id++;
+	list_add_tail(&q->list, &htb_list);
+	mutex_unlock(&htb_list_lock);
 	return 0;
 }
 
@@ -1190,8 +1202,8 @@ static int htb_dump_class(struct Qdisc *sch, unsigned long arg,
 {
 	struct htb_class *cl = (struct htb_class *)arg;
 	spinlock_t *root_lock = qdisc_root_sleeping_lock(sch);
-//	struct nlattr *nest;
-//	struct tc_htb_opt opt;
+	struct nlattr *nest;
+	struct tc_htb_opt opt;
 
 	spin_lock_bh(root_lock);
 	tcm->tcm_parent = cl->parent ? cl->parent->common.classid : TC_H_ROOT;
@@ -1199,9 +1211,6 @@ static int htb_dump_class(struct Qdisc *sch, unsigned long arg,
 	if (!cl->level && cl->un.leaf.q)
 		tcm->tcm_info = cl->un.leaf.q->handle;
 
-	spin_unlock_bh(root_lock);
-	return skb->len;
-/*
 	nest = nla_nest_start(skb, TCA_OPTIONS);
 	if (nest == NULL)
 		goto nla_put_failure;
@@ -1219,6 +1228,9 @@ static int htb_dump_class(struct Qdisc *sch, unsigned long arg,
 	opt.quantum = cl->quantum;
 	opt.prio = cl->prio;
 	opt.level = cl->level;
+	opt.thr_ceil = cl->thr_ceil;
+	opt.thr_burst = cl->thr_burst;
+	opt.interval = cl->measure_interval * HTB_RATEMEASURE / HZ;
 	NLA_PUT(skb, TCA_HTB_PARMS, sizeof(opt), &opt);
 
 	nla_nest_end(skb, nest);
@@ -1229,7 +1241,6 @@ nla_put_failure:
 	spin_unlock_bh(root_lock);
 	nla_nest_cancel(skb, nest);
 	return -1;
-*/
 }
 
 static int
@@ -1344,19 +1355,11 @@ static void htb_destroy_class(struct Qdisc *sch, struct htb_class *cl)
 	qdisc_put_rtab(cl->rate);
 	qdisc_put_rtab(cl->ceil);
 
+	if (cl->burst)
+		qdisc_put_rtab(cl->burst);
+
 	tcf_destroy_chain(&cl->filter_list);
-	if (cl->burst) {
-	    qdisc_put_rtab(cl->burst);
-	    atomic_set(&cl->dead, 1);
-	    if (del_timer(&cl->burst_timer)) {
-		    dev_put(cl->dev);
 	kfree(cl);
-		    atomic_dec(&burst_class_count);
-	    }
-	}
-	else {
-		kfree(cl);
-	}
 }
 
 static void htb_destroy(struct Qdisc *sch)
@@ -1366,6 +1369,11 @@ static void htb_destroy(struct Qdisc *sch)
 	struct htb_class *cl;
 	unsigned int i;
 
+	mutex_lock(&htb_list_lock);
+	if (q->list.next)
+		list_del(&q->list);
+	mutex_unlock(&htb_list_lock);
+
 	cancel_work_sync(&q->work);
 	qdisc_watchdog_cancel(&q->watchdog);
 	/* This line used to be after htb_destroy_class call below
@@ -1381,8 +1389,11 @@ static void htb_destroy(struct Qdisc *sch)
 	}
 	for (i = 0; i < q->clhash.hashsize; i++) {
 		hlist_for_each_entry_safe(cl, n, next, &q->clhash.hash[i],
-					  common.hnode)
+					  common.hnode) {
+			radix_tree_delete(&q->classes,
+					  TC_H_MIN(cl->common.classid));
 			htb_destroy_class(sch, cl);
+		}
 	}
 	qdisc_class_hash_destroy(&q->clhash);
 	__skb_queue_purge(&q->direct_queue);
@@ -1418,6 +1429,7 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg)
 
 	/* delete from hash and active; remainder in destroy_class */
 	qdisc_class_hash_remove(&q->clhash, &cl->common);
+	radix_tree_delete(&q->classes, TC_H_MIN(cl->common.classid));
 	if (cl->parent)
 		cl->parent->children--;
 
@@ -1458,6 +1470,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	struct nlattr *opt = tca[TCA_OPTIONS];
 	struct qdisc_rate_table *rtab = NULL, *ctab = NULL, *btab = NULL;
 	struct nlattr *tb[__TCA_HTB_MAX];
+	int preloaded = 0;
 	struct tc_htb_opt *hopt;
 
 	/* extract all subattrs from opt attr */
@@ -1524,7 +1537,6 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		}
 
 		cl->refcnt = 1;
-		atomic_set(&cl->dead, 0);
 		cl->children = 0;
 		INIT_LIST_HEAD(&cl->un.leaf.drop_list);
 		RB_CLEAR_NODE(&cl->pq_node);
@@ -1538,6 +1550,14 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		 */
 		new_q = qdisc_create_dflt(sch->dev_queue,
 					  &pfifo_qdisc_ops, classid);
+		if (radix_tree_preload(GFP_KERNEL)) {
+			if (new_q)
+				qdisc_destroy(new_q);
+			gen_kill_estimator(&cl->bstats, &cl->rate_est);
+			kfree(cl);
+			goto failure;
+		}
+		preloaded = 1;
 		sch_tree_lock(sch);
 		if (parent && !parent->level) {
 			unsigned int qlen = parent->un.leaf.q->q.qlen;
@@ -1574,10 +1594,9 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 
 		/* attach to the hash list and parent's family */
 		qdisc_class_hash_insert(&q->clhash, &cl->common);
+		radix_tree_insert(&q->classes, TC_H_MIN(classid), cl);
 		if (parent)
 			parent->children++;
-
-		cl->qdisc = sch;
 	} else {
 		if (tca[TCA_RATE]) {
 			err = gen_replace_estimator(&cl->bstats, &cl->rate_est,
@@ -1616,10 +1635,10 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 
 	cl->thr_ceil = hopt->thr_ceil;
 	cl->thr_burst = hopt->thr_burst;
-	cl->measure_interval = hopt->interval * HZ / HTB_RATEMEASURE;
-	memset(cl->rates, 0, sizeof(unsigned) * HTB_RATEMEASURE);
-	cl->rate_sum = 0;
-	cl->prev_bytes = cl->bstats.bytes;
+	cl->measure_interval = max(hopt->interval * HZ / HTB_RATEMEASURE, 1U);
+	cl->avg_rate = 0;
+	cl->burst_bytes = 0;
+	cl->burst_stamp = jiffies;
 
 	cl->buffer = hopt->buffer;
 	cl->cbuffer = hopt->cbuffer;
@@ -1635,15 +1654,6 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	cl->burst = btab;
 
 	if (btab) {
-		atomic_set(&cl->dead, 0);
-		cl->dev = qdisc_dev(sch);
-		dev_hold(cl->dev);
-		atomic_inc(&burst_class_count);
-
-		init_timer(&cl->burst_timer);
-		cl->burst_timer.function = htb_burst_timer;
-		cl->burst_timer.data = (unsigned long) cl;
-		mod_timer(&cl->burst_timer, jiffies + cl->measure_interval);
 		cl->actual_ceil = cl->burst;
 		cl->acbuffer = cl->bbuffer;
 	}
@@ -1653,8 +1663,8 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	}
 
 	sch_tree_unlock(sch);
-
-	qdisc_class_hash_grow(sch, &q->clhash);
+	if (preloaded)
+		radix_tree_preload_end();
 
 	*arg = (unsigned long)cl;
 	return 0;
@@ -1705,41 +1715,231 @@ static void htb_unbind_filter(struct Qdisc *sch, unsigned long arg)
 		cl->filter_cnt--;
 }
 
+/* arg->skip is the classid to resume at, in classid order */
 static void htb_walk(struct Qdisc *sch, struct qdisc_walker *arg)
 {
 	struct htb_sched *q = qdisc_priv(sch);
-	struct htb_class *cl;
-	struct hlist_node *n;
-	unsigned int i = 0;
-	unsigned found = 0;
+	struct htb_class *batch[16];
+	unsigned long index = TC_H_MIN(arg->skip);
+	unsigned int i, n;
 
 	if (arg->stop)
 		return;
 
-	if (arg->skip) {
-		i = qdisc_class_hash(arg->skip, q->clhash.hashmask);
-	}
-	else {
-		found = 1;
-	}
+	do {
+		n = radix_tree_gang_lookup(&q->classes, (void **)batch, index,
+					   ARRAY_SIZE(batch));
+		for (i = 0; i < n; i++) {
+			struct htb_class *cl = batch[i];
 
-	for (; i < q->clhash.hashsize; i++) {
-		hlist_for_each_entry(cl, n, &q->clhash.hash[i], common.hnode) {
-			if (!found) {
-				if (arg->skip != cl->common.classid) {
-				continue;
-			}
-				found = 1;
-			}
+			index = TC_H_MIN(cl->common.classid) + 1;
 			if (arg->fn(sch, (unsigned long)cl, arg) < 0) {
 				arg->count = cl->common.classid;
 				arg->stop = 1;
 				return;
 			}
 		}
+	} while (n == ARRAY_SIZE(batch));
+}
+
+#ifdef CONFIG_PROC_FS
+/*
+ * /proc/net/htb_stats - bytes, packets, drops and backlog of every class
+ * of every htb qdisc in the netns. Classes are copied HTB_STATS_CHUNK at a time under
+ * the root lock and printed after it is released, so a full export of a
+ * large tree never holds the lock for long.
+ */
+#define HTB_STATS_CHUNK 64
+
+struct htb_stats_entry {
+	u32 classid;
+	u32 packets;
+	u64 bytes;
+	u32 drops;
+	u32 backlog;
+	u32 qlen;
+};
+
+struct htb_stats_iter {
+	struct seq_net_private p;
+	u32 qid;		/* qdisc id the chunk came from */
+	unsigned long index;	/* next classid minor to copy */
+	loff_t pos;		/* position of entry[i] */
+	unsigned int i, n;
+	char dev[IFNAMSIZ];
+	struct htb_stats_entry entry[HTB_STATS_CHUNK];
+};
+
+/* under htb_list_lock */
+static void htb_stats_fill(struct htb_stats_iter *it, struct net *net)
+{
+	struct htb_class *batch[HTB_STATS_CHUNK];
+	struct htb_sched *q;
+	unsigned int i;
+
+	it->i = 0;
+	it->n = 0;
+	list_for_each_entry(q, &htb_list, list) {
+		struct Qdisc *sch = q->watchdog.qdisc;
+		spinlock_t *root_lock;
+
+		if (q->id < it->qid || !net_eq(dev_net(qdisc_dev(sch)), net))
+			continue;
+		if (q->id > it->qid) {
+			it->qid = q->id;
+			it->index = 0;
+		}
+
+		root_lock = qdisc_root_sleeping_lock(sch);
+		spin_lock_bh(root_lock);
+		it->n = radix_tree_gang_lookup(&q->classes, (void **)batch,
+					       it->index, HTB_STATS_CHUNK);
+		for (i = 0; i < it->n; i++) {
+			struct htb_class *cl = batch[i];
+			struct htb_stats_entry *e = &it->entry[i];
+
+			e->classid = cl->common.classid;
+			e->bytes = cl->bstats.bytes;
+			e->packets = cl->bstats.packets;
+			e->drops = cl->qstats.drops;
+			e->backlog = 0;
+			e->qlen = 0;
+			if (!cl->level && cl->un.leaf.q) {
+				e->drops += cl->un.leaf.q->qstats.drops;
+				e->backlog = cl->un.leaf.q->qstats.backlog;
+				e->qlen = cl->un.leaf.q->q.qlen;
+			}
+			it->index = TC_H_MIN(cl->common.classid) + 1;
+		}
+		spin_unlock_bh(root_lock);
+
+		if (it->n) {
+			memcpy(it->dev, qdisc_dev(sch)->name, IFNAMSIZ);
+			return;
+		}
+		it->qid = q->id + 1;
+		it->index = 0;
 	}
 }
 
+static struct htb_stats_entry *htb_stats_cur(struct seq_file *seq)
+{
+	struct htb_stats_iter *it = seq->private;
+
+	if (it->i >= it->n)
+		htb_stats_fill(it, seq_file_net(seq));
+	return it->n ? &it->entry[it->i] : NULL;
+}
+
+static void *htb_stats_start(struct seq_file *seq, loff_t *pos)
+{
+	struct htb_stats_iter *it = seq->private;
+
+	mutex_lock(&htb_list_lock);
+	if (!*pos || *pos < it->pos) {
+		it->qid = 0;
+		it->index = 0;
+		it->i = it->n = 0;
+		it->pos = 0;
+	}
+	if (!*pos)
+		return SEQ_START_TOKEN;
+	/* seq_read() resumes at the record it stopped at or at the one
+	 * after it, any other position is reached by walking from the
+	 * start */
+	while (it->pos < *pos) {
+		if (it->pos)
+			it->i++;
+		it->pos++;
+		if (!htb_stats_cur(seq))
+			return NULL;
+	}
+	return htb_stats_cur(seq);
+}
+
+static void *htb_stats_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	struct htb_stats_iter *it = seq->private;
+
+	if (v != SEQ_START_TOKEN)
+		it->i++;
+	it->pos = ++*pos;
+	return htb_stats_cur(seq);
+}
+
+static void htb_stats_stop(struct seq_file *seq, void *v)
+{
+	mutex_unlock(&htb_list_lock);
+}
+
+static int htb_stats_show(struct seq_file *seq, void *v)
+{
+	struct htb_stats_iter *it = seq->private;
+	struct htb_stats_entry *e = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(seq, "dev classid bytes packets drops backlog qlen\n");
+		return 0;
+	}
+	seq_printf(seq, "%s %x:%x %llu %u %u %u %u\n", it->dev,
+		   TC_H_MAJ(e->classid) >> 16, TC_H_MIN(e->classid),
+		   (unsigned long long)e->bytes, e->packets, e->drops,
+		   e->backlog, e->qlen);
+	return 0;
+}
+
+static const struct seq_operations htb_stats_seq_ops = {
+	.start	= htb_stats_start,
+	.next	= htb_stats_next,
+	.stop	= htb_stats_stop,
+	.show	= htb_stats_show,
+};
+
+static int htb_stats_open(struct inode *inode, struct file *file)
+{
+	return seq_open_net(inode, file, &htb_stats_seq_ops,
+			    sizeof(struct htb_stats_iter));
+}
+
+static const struct file_operations htb_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= htb_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release_net,
+};
+
+static int __net_init htb_net_init(struct net *net)
+{
+	struct proc_dir_entry *e;
+
+	e = proc_net_fops_create(net, "htb_stats", S_IRUGO, &htb_stats_fops);
+	if (e == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void __net_exit htb_net_exit(struct net *net)
+{
+	proc_net_remove(net, "htb_stats");
+}
+#else
+static int __net_init htb_net_init(struct net *net)
+{
+	return 0;
+}
+
+static void __net_exit htb_net_exit(struct net *net)
+{
+}
+#endif
+
+static struct pernet_operations htb_net_ops = {
+	.init = htb_net_init,
+	.exit = htb_net_exit,
+};
+
 static const struct Qdisc_class_ops htb_class_ops = {
 	.graft		=	htb_graft,
 	.leaf		=	htb_leaf,
@@ -1774,15 +1974,20 @@ static struct Qdisc_ops htb_qdisc_ops __read_mostly = {
 
 static int __init htb_module_init(void)
 {
-	return register_qdisc(&htb_qdisc_ops);
+	int err;
+
+	err = register_pernet_subsys(&htb_net_ops);
+	if (err)
+		return err;
+	err = register_qdisc(&htb_qdisc_ops);
+	if (err)
+		unregister_pernet_subsys(&htb_net_ops);
+	return err;
 }
 static void __exit htb_module_exit(void)
 {
 	unregister_qdisc(&htb_qdisc_ops);
-
-	while (atomic_read(&burst_class_count)) {
-		schedule();
-	}
+	unregister_pernet_subsys(&htb_net_ops);
 }
 
 module_init(htb_module_init)